@@ -0,0 +1,193 @@
+/*
+ * File: chacha20.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "chacha20.h"
+
+#define ROTL32(v, n) 	(((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTER_ROUND(a, b, c, d) 			\
+	a += b; d ^= a; d = ROTL32(d, 16); 		\
+	c += d; b ^= c; b = ROTL32(b, 12); 		\
+	a += b; d ^= a; d = ROTL32(d, 8); 		\
+	c += d; b ^= c; b = ROTL32(b, 7);
+
+static uint32_t load32_le(const unsigned char *p) {
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void store32_le(unsigned char *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/**
+ * Set up the state: constants | key | counter | nonce
+ */
+void chacha20_init(struct chacha20 *cipher, const unsigned char *key, const unsigned char *nonce, uint32_t counter) {
+	int i;
+
+	// "expand 32-byte k"
+	cipher->state[0] = 0x61707865;
+	cipher->state[1] = 0x3320646e;
+	cipher->state[2] = 0x79622d32;
+	cipher->state[3] = 0x6b206574;
+
+	for (i=0; i<8; i++) {
+		cipher->state[4 + i] = load32_le(key + 4*i);
+	}
+
+	cipher->state[12] = counter;
+	for (i=0; i<3; i++) {
+		cipher->state[13 + i] = load32_le(nonce + 4*i);
+	}
+}
+
+/**
+ * Write nb_blocks blocks of keystream to out, moving the counter along
+ */
+void chacha20_blocks(struct chacha20 *cipher, unsigned char *out, size_t nb_blocks) {
+	uint32_t x[16];
+	size_t block;
+	int i;
+
+	for (block=0; block<nb_blocks; block++) {
+		memcpy(x, cipher->state, sizeof(x));
+
+		// 20 rounds: 10 column rounds and 10 diagonal rounds
+		for (i=0; i<10; i++) {
+			QUARTER_ROUND(x[0], x[4], x[8],  x[12]);
+			QUARTER_ROUND(x[1], x[5], x[9],  x[13]);
+			QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+			QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+			QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+			QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+			QUARTER_ROUND(x[2], x[7], x[8],  x[13]);
+			QUARTER_ROUND(x[3], x[4], x[9],  x[14]);
+		}
+
+		for (i=0; i<16; i++) {
+			store32_le(out + 4*i, x[i] + cipher->state[i]);
+		}
+
+		if (0 == ++cipher->state[12]) {
+			cipher->state[13]++;
+		}
+		out += CHACHA20_BLOCK_SIZE;
+	}
+}
+
+/**
+ * Move the counter to 'block' (the first nonce word takes the high half)
+ */
+void chacha20_seek(struct chacha20 *cipher, uint64_t block) {
+	cipher->state[12] = (uint32_t) block;
+	cipher->state[13] = (uint32_t) (block >> 32);
+}
+
+/**
+ * XOR LANES blocks of keystream into out, computed on vectors: word i
+ * of the blocks lives in x[i], the counters being their only difference
+ * One copy per instruction set, with as many lanes as its registers
+ * hold. The counter must not wrap within the blocks
+ */
+#define CHACHA20_XOR_DEFINE(LANES, TARGET) 													\
+	__attribute__((target(TARGET))) 														\
+	static void chacha20_xor_##LANES(struct chacha20 *cipher, unsigned char *out, 			\
+									 const unsigned char *in) { 							\
+		typedef uint32_t vec __attribute__((vector_size(4 * LANES))); 						\
+		vec x[16], s[16]; 																	\
+		uint32_t ks[16][LANES]; 															\
+		int i, b; 																			\
+																							\
+		for (i=0; i<16; i++) { 																\
+			for (b=0; b<LANES; b++) { 														\
+				s[i][b] = cipher->state[i]; 												\
+			} 																				\
+		} 																					\
+		for (b=0; b<LANES; b++) { 															\
+			s[12][b] += b; 																	\
+		} 																					\
+		memcpy(x, s, sizeof(x)); 															\
+																							\
+		for (i=0; i<10; i++) { 																\
+			QUARTER_ROUND(x[0], x[4], x[8],  x[12]); 										\
+			QUARTER_ROUND(x[1], x[5], x[9],  x[13]); 										\
+			QUARTER_ROUND(x[2], x[6], x[10], x[14]); 										\
+			QUARTER_ROUND(x[3], x[7], x[11], x[15]); 										\
+			QUARTER_ROUND(x[0], x[5], x[10], x[15]); 										\
+			QUARTER_ROUND(x[1], x[6], x[11], x[12]); 										\
+			QUARTER_ROUND(x[2], x[7], x[8],  x[13]); 										\
+			QUARTER_ROUND(x[3], x[4], x[9],  x[14]); 										\
+		} 																					\
+																							\
+		for (i=0; i<16; i++) { 																\
+			x[i] += s[i]; 																	\
+		} 																					\
+		memcpy(ks, x, sizeof(ks)); 															\
+																							\
+		for (b=0; b<LANES; b++) { 															\
+			for (i=0; i<16; i++) { 															\
+				store32_le(out + 4*i, load32_le(in + 4*i) ^ ks[i][b]); 						\
+			} 																				\
+			out += CHACHA20_BLOCK_SIZE; 													\
+			in  += CHACHA20_BLOCK_SIZE; 													\
+		} 																					\
+																							\
+		cipher->state[12] += LANES; 														\
+	}
+
+CHACHA20_XOR_DEFINE(4, "sse2")
+CHACHA20_XOR_DEFINE(8, "avx2")
+CHACHA20_XOR_DEFINE(16, "avx512f")
+
+/**
+ * out = in XOR keystream, len octets (out may be in)
+ * A final partial block uses up a whole block of keystream, so only
+ * the last call of a message may have a length that is not a multiple
+ * of CHACHA20_BLOCK_SIZE
+ */
+void chacha20_xor(struct chacha20 *cipher, unsigned char *out, const unsigned char *in, size_t len) {
+	void (*xor_blocks)(struct chacha20 *, unsigned char *, const unsigned char *);
+	unsigned char block[CHACHA20_BLOCK_SIZE];
+	size_t i, n, lanes;
+
+	// widest vectors of the CPU
+	if (__builtin_cpu_supports("avx512f")) {
+		xor_blocks = chacha20_xor_16;
+		lanes 	   = 16;
+	} else if (__builtin_cpu_supports("avx2")) {
+		xor_blocks = chacha20_xor_8;
+		lanes 	   = 8;
+	} else {
+		xor_blocks = chacha20_xor_4;
+		lanes 	   = 4;
+	}
+
+	while (len >= lanes * CHACHA20_BLOCK_SIZE && cipher->state[12] <= UINT32_MAX - lanes) {
+		xor_blocks(cipher, out, in);
+		out += lanes * CHACHA20_BLOCK_SIZE;
+		in  += lanes * CHACHA20_BLOCK_SIZE;
+		len -= lanes * CHACHA20_BLOCK_SIZE;
+	}
+
+	// tail, and the blocks around a counter wrap
+	while (len > 0) {
+		chacha20_blocks(cipher, block, 1);
+		n = len < CHACHA20_BLOCK_SIZE ? len : CHACHA20_BLOCK_SIZE;
+		for (i=0; i<n; i++) {
+			out[i] = in[i] ^ block[i];
+		}
+		out += n;
+		in  += n;
+		len -= n;
+	}
+
+	memset(block, 0, sizeof(block));
+}
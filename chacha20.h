@@ -0,0 +1,30 @@
+/*
+ * File: chacha20.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_CHACHA20_
+#define _H_CHACHA20_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHACHA20_KEY_SIZE 		32
+#define CHACHA20_NONCE_SIZE 	12
+#define CHACHA20_BLOCK_SIZE 	64
+
+/**
+ * ChaCha20 (RFC 8439): 256-bit key, 96-bit nonce, 32-bit block counter
+ * The counter carries into the first nonce word, so a zero nonce gives
+ * the 64-bit counter of the original ChaCha layout
+ */
+struct chacha20 {
+	uint32_t state[16];
+};
+
+void chacha20_init(struct chacha20 *cipher, const unsigned char *key, const unsigned char *nonce, uint32_t counter);
+void chacha20_seek(struct chacha20 *cipher, uint64_t block);
+void chacha20_blocks(struct chacha20 *cipher, unsigned char *out, size_t nb_blocks);
+void chacha20_xor(struct chacha20 *cipher, unsigned char *out, const unsigned char *in, size_t len);
+
+#endif // _H_CHACHA20_
@@ -8,34 +8,49 @@
 #include <time.h>
 #include <gmp.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "rsa.h"
 #include "rsa_keys.h"
+#include "rsa_pool.h"
+#include "rsa_stream.h"
+#include "rsa_server.h"
+#include "rsa_stats.h"
+#include "rsa_alloc.h"
 
 #define BASE_SAVE 		61
 #define MAX_CHARS_LINES 50
 
+/**
+ * Print the error of the last failed library call, then leave
+ */
+void fail(void) {
+	printf("%s\n", rsa_errmsg());
+	exit(1);
+}
+
 /**
  * Encrypt a given file with a pre-saved public key
+ * The chunks are spread over nb_threads workers and written in order
+ * In hybrid mode, RSA only wraps a ChaCha20 key for the payload
  */
-void encrypt_file(char *filename_plain) {
+void encrypt_file(char *filename_plain, int nb_threads, int hybrid) {
 	// vars
-	FILE *fp_plain, *size_of_file, *fp_rsa;
+	FILE *fp_plain, *fp_rsa;
+	struct rsa_pool *pool;
+	uint64_t size;
 	mpz_t n, e;
-	unsigned char **encrypted, **plain;
-	unsigned long size, max_line;
-	char command_wc[11], count[3], ch_plain;
-	int k, i, j, nb_elements, step, status_pubkey;
+	int status;
 	
-	// generating the key pair
-	status_pubkey = load_pub(n, e);
-	if (status_pubkey == -1) {
-		exit(1);
+	// retrieving the public key
+	STATS_BEGIN(t);
+	if (load_pub(n, e) == -1) {
+		fail();
 	}
-	k = mpz_size(n) * GMP_LIMB_BITS / 8;
+	STATS_END(STAGE_KEY_LOAD, t);
 	
 	// opening the file (not encrypted)
 	fp_plain = fopen(filename_plain, "r");
@@ -46,288 +61,122 @@ void encrypt_file(char *filename_plain) {
 		mpz_clears(n, e, NULL);
 		exit(1);
 	}
-
-	// retreiving size of *plain
-	sprintf(command_wc, "wc -c < %s", filename_plain);
-	size_of_file = popen(command_wc, "r");
-	
-	fgets(count, 10, size_of_file);
-	pclose(size_of_file);
-	size = atoi(count);
-	
-	// message length can be a maximum of (k-11)
-	// allocating memory for plain
-	nb_elements = 0;
-	plain = malloc((((size-size%(k-11))/(k-11)) + 1) * sizeof(*plain));
-	if (NULL == plain) {
-		printf("Memory error.\n");
-		mpz_clears(n, e, NULL);
-		exit(1);
-	}
-	
-	for (i=0; i<((size-size%(k-11))/(k-11)); i++) {
-		plain[i] = malloc((k-11) * sizeof(plain[i]));
-		if (NULL == plain[i]) {
-			printf("Memory error\n");
-			mpz_clears(n, e, NULL);
-			exit(1);
-		}
-		
-		memset(plain[i], '\0', (k-11));
-		nb_elements++;
-	}
 	
-	plain[i] = malloc((size % (k-11)) * sizeof(plain[i]));
-	if (NULL == plain[i]) {
-		printf("Memory error\n");
+	fp_rsa = fopen("encrypted", "w");
+	if (NULL == fp_rsa) {
+		printf("Unable to open a file for encryption. Aborting.\n");
+		fclose(fp_plain);
 		mpz_clears(n, e, NULL);
 		exit(1);
 	}
-	memset(plain[i], '\0', size % (k-11));
-	nb_elements++;
-	
-	// retrieving plain text
-	i = -1;
-	step = 0;
-	while (1) {
-		i++;
-		if (step != (nb_elements - 1)) {
-			if (i < (k-11)) {
-				plain[step][i] = fgetc(fp_plain);
-			} else {
-				i = -1;
-				step++;
-				continue;
-			}
-		} else {
-			ch_plain = fgetc(fp_plain);
-			if (feof(fp_plain)) {
-				fclose(fp_plain);
-				break;
-			} else {
-				plain[step][i] = ch_plain;
-			}
-		}
-	}
 	
 	// encrypting
-	encrypted = malloc((((size-size%(k-11))/(k-11)) + 1) * sizeof(*encrypted));
-	if (NULL == encrypted) {
-		printf("Memory error");
-		mpz_clears(n, e, NULL);
-		exit(1);
+	pool = pool_create(nb_threads);
+	if (NULL == pool) {
+		status = -1;
+	} else {
+		status = hybrid ? stream_hybrid_encrypt(fp_plain, fp_rsa, n, e, pool, &size)
+						: stream_encrypt(fp_plain, fp_rsa, n, e, pool, &size);
+		pool_destroy(pool);
 	}
 	
-	fp_rsa = fopen("encrypted", "w");
-	for (i=0; i<nb_elements; i++) {
-		encrypted[i] = malloc(k * sizeof(encrypted[i]));
-		if (NULL == encrypted[i]) {
-			printf("Memory error.\n");
-			mpz_clears(n, e, NULL);
-			exit(1);
-		}
-		memset(encrypted[i], '\0', k);
-		
-		encrypted[i] = rsaes_pkcs1_encrypt(n, e, plain[i]);
-		free(plain[i]);
-		if (NULL == encrypted[i]) {
-			free(plain);
-			free(encrypted);
-			mpz_clears(n, e, NULL);
-			exit(1);
-		}
-		
-		// write
-		for (j=0; j<k; j++) {
-			fputc(encrypted[i][j], fp_rsa);
-		}
-		
-		free(encrypted[i]);
-	}
+	fclose(fp_plain);
 	fclose(fp_rsa);
-	
-	// clearing pub key
 	mpz_clears(n, e, NULL);
-	free(plain);
-	free(encrypted);
+	
+	if (-1 == status) {
+		fail();
+	}
 }
 
 /**
- * Decrypt a given file with a pre-saved private key
+ * Decrypt the octets [start, start+len) of a given file with a
+ * pre-saved private key (len = UINT64_MAX: up to the end)
+ * The blocks are spread over nb_threads workers and written in order
+ * Hybrid files are recognized by their header
+ * The plaintext goes to a temporary file, renamed to 'decrypted' once
+ * every block is decrypted (and every chunk of a hybrid file
+ * authenticated), removed otherwise
  */
-void decrypt_file(char *filename_encrypted) {
+void decrypt_file(char *filename_encrypted, int nb_threads, uint64_t start, uint64_t len) {
 	// vars
-	FILE *chars_count, *fp_encrypted, *fp_rsa;
-	unsigned char **encrypted, **decrypted;
-	char *wc_command, chars_result[5];
-	mpz_t n, d;
-	int chars, i, j, k, nb_decrypt;
+	FILE *fp_encrypted, *fp_rsa;
+	struct rsa_pool *pool;
+	struct rsa_priv K;
+	char temp[] = "decrypted.XXXXXX";
+	uint64_t size;
+	int status, fd;
 	
 	// retrieving rsa key pair (private)
-	if (load_priv(n, d) == -1) {
-		exit(1);
+	STATS_BEGIN(t);
+	if (load_priv(&K) == -1) {
+		fail();
 	}
-	k = mpz_size(n) * GMP_LIMB_BITS / 8;
+	STATS_END(STAGE_KEY_LOAD, t);
 	
 	// trying to open the file
 	fp_encrypted = fopen(filename_encrypted, "r");
 	if (NULL == fp_encrypted) {
-		mpz_clears(n, d, NULL);
+		rsa_priv_clear(&K);
 		printf("File doesn't exists. Aborting.\n");
 		exit(1);
 	}
 	
-	// number of chars in encrypted file
-	wc_command = malloc((strlen(filename_encrypted) + 8) * sizeof(char *));
-	sprintf(wc_command, "wc -c < %s", filename_encrypted);
-	
-	chars_count = popen(wc_command, "r");
-	free(wc_command);
-	fgets(chars_result, 5, chars_count);
-	pclose(chars_count);
-	chars = atoi(chars_result);
-	
-	fp_rsa = fopen("decrypted", "w");
+	fd 	   = mkstemp(temp);
+	fp_rsa = fd < 0 ? NULL : fdopen(fd, "w");
 	if (NULL == fp_rsa) {
-		mpz_clears(n, d, NULL);
 		printf("Unable to open a file for decryption. Aborting.\n");
+		if (fd >= 0) {
+			close(fd);
+			unlink(temp);
+		}
+		fclose(fp_encrypted);
+		rsa_priv_clear(&K);
 		exit(1);
 	}
 	
-	if (chars > k) {
-		// how many times we will decrypt
-		nb_decrypt = chars / k;
-		
-		// allocating
-		encrypted = malloc(nb_decrypt * sizeof(*encrypted));
-		if (NULL == encrypted) {
-			fclose(fp_rsa);
-			fclose(fp_encrypted);
-			mpz_clears(n, d, NULL);
-			
-			printf("Memory error.\n");
-			exit(1);
-		}
-		
-		decrypted = malloc(nb_decrypt * sizeof(*decrypted));
-		if (NULL == decrypted) {
-			free(encrypted);
-			fclose(fp_rsa);
-			fclose(fp_encrypted);
-			mpz_clears(n, d, NULL);
-			
-			printf("Memory error.\n");
-			exit(1);
-		}
-		
-		for (i=0; i<nb_decrypt; i++) {
-			// allocating
-			encrypted[i] = malloc(k * sizeof(encrypted[i]));
-			if (NULL == encrypted[i]) {
-				free(encrypted);
-				free(decrypted);
-				fclose(fp_encrypted);
-				fclose(fp_rsa);
-				mpz_clears(n, d, NULL);
-				
-				printf("Memory error.\n");
-				exit(1);
-			}
-			
-			// retrieving encrypted data
-			for (j=0; j<k; j++) {				
-				encrypted[i][j] = fgetc(fp_encrypted);
-			}
-			
-			decrypted[i] = rsads_pkcs1_decrypt(n, d, k, encrypted[i]);
-			free(encrypted[i]);
-			if (NULL == decrypted[i]) {
-				free(encrypted);
-				free(decrypted);
-				fclose(fp_encrypted);
-				fclose(fp_rsa);
-				mpz_clears(n, d, NULL);
-				
-				exit(1);
-			}
-			
-			for (j=0; j<strlen(decrypted[i]); j++) {
-				fputc(decrypted[i][j], fp_rsa);
-			}
-			free(decrypted[i]);
-		}
-		
-		fclose(fp_rsa);
-		fclose(fp_encrypted);
-		mpz_clears(n, d, NULL);
+	// decrypting
+	pool = pool_create(nb_threads);
+	if (NULL == pool) {
+		status = -1;
 	} else {
-		// allocating encrypted
-		encrypted = malloc(sizeof(*encrypted));
-		if (NULL == encrypted) {
-			fclose(fp_encrypted);
-			fclose(fp_rsa);
-			printf("Memory error.\n");
-			exit(1);
-		}
-		
-		encrypted[0] = malloc(k * sizeof(encrypted[0]));
-		if (NULL == encrypted[0]) {
-			free(encrypted);
-			fclose(fp_encrypted);
-			fclose(fp_rsa);
-			mpz_clears(n, d, NULL);
-			
-			printf("Memory error. \n");
-			exit(1);
-		}
-		
-		// retrieving encrypted data
-		for (i=0; i<k; i++) {
-			encrypted[0][i] = fgetc(fp_encrypted);
-		}
-		fclose(fp_encrypted);
-		
-		// allocating decrypted
-		decrypted = malloc(sizeof(*decrypted));
-		if (NULL == decrypted) {
-			free(encrypted);
-			fclose(fp_rsa);
-			mpz_clears(n, d, NULL);
-			
-			printf("Memory error.\n");
-			exit(1);
-		}
-		
-		// encrypting
-		decrypted[0] = rsads_pkcs1_decrypt(n, d, k, encrypted[0]);		
-		mpz_clears(n, d, NULL);
-		free(encrypted[0]);
-		if (NULL == decrypted[0]) {
-			fclose(fp_rsa);
-			free(encrypted);
-			free(decrypted);
-			
-			exit(1);
-		}
-		
-		// writting decrypted data
-		for (i=0; i<k; i++) {
-			fputc(decrypted[0][i], fp_rsa);
+		if (!stream_is_hybrid(fp_encrypted)) {
+			status = stream_decrypt_range(fp_encrypted, fp_rsa, &K, pool, start, len, &size);
+		} else if (0 == start && UINT64_MAX == len) {
+			status = stream_hybrid_decrypt(fp_encrypted, fp_rsa, &K, pool, &size);
+		} else {
+			rsa_error(RSA_EINVAL, "--range is not supported for hybrid files.");
+			status = -1;
 		}
-		fclose(fp_rsa);
-		free(decrypted[0]);
+		pool_destroy(pool);
+	}
+	
+	fclose(fp_encrypted);
+	if (0 != fclose(fp_rsa) && 0 == status) {
+		rsa_error(RSA_EIO, "Write error.");
+		status = -1;
 	}
+	rsa_priv_clear(&K);
 	
-	free(encrypted);
-	free(decrypted);
+	// nothing of a failed decryption is kept
+	if (0 == status && 0 != rename(temp, "decrypted")) {
+		rsa_error(RSA_EIO, "Unable to rename '%s' to 'decrypted'.", temp);
+		status = -1;
+	}
+	if (-1 == status) {
+		unlink(temp);
+		fail();
+	}
 }
 
 /**
- * Save a key pair (public and private key) into .rsa directory 
+ * Save a key pair (public and private key), with a modulus of 'bits'
+ * bits and nb_primes primes, into .rsa directory 
  */
-void key_pair() {
+void key_pair(int bits, int nb_primes, int nb_threads) {
 	int dir_exists;
-	mpz_t n, e, d;
+	mpz_t e;
+	struct rsa_priv K;
 	
 	// checking .rsa existance
 	dir_exists = mkdir(".rsa", 0755);
@@ -345,72 +194,198 @@ void key_pair() {
 		
 		if ('y' == user_choice) {
 			// init
-			mpz_inits(n, e, d, NULL);
+			mpz_init(e);
+			rsa_priv_init(&K);
 			
 			// generating key pair
 			printf("Generating key pair...");
-			generate_keypair(n, e, d);
+			fflush(stdout);
+			if (-1 == generate_keypair_multi(e, &K, bits, nb_primes, nb_threads)) {
+				printf("\n");
+				fail();
+			}
 			printf(" Done.\n");
 			
 			// saving
-			if (-1 == save_keypair(n, e, d)) {
-				mpz_clears(n, e, d, NULL);
-				exit(1);
+			if (-1 == save_keypair(e, &K)) {
+				mpz_clear(e);
+				rsa_priv_clear(&K);
+				fail();
 			}
 			
 			// cleaning
-			mpz_clears(n, e, d, NULL);
+			mpz_clear(e);
+			rsa_priv_clear(&K);
 		}
 	}
 	
 	// .rsa doesn't exists
 	else {
 		// inits
-		mpz_inits(n, e, d, NULL);
+		mpz_init(e);
+		rsa_priv_init(&K);
 		
 		// generating
 		printf("Generating key pair...");
-		generate_keypair(n, e, d);
+		fflush(stdout);
+		if (-1 == generate_keypair_multi(e, &K, bits, nb_primes, nb_threads)) {
+			printf("\n");
+			fail();
+		}
 		printf(" Done.\n");
 		
 		// saving
-		save_keypair(n, e, d);
+		if (-1 == save_keypair(e, &K)) {
+			mpz_clear(e);
+			rsa_priv_clear(&K);
+			fail();
+		}
 		
 		// cleaning
-		mpz_clears(n, e, d, NULL);
+		mpz_clear(e);
+		rsa_priv_clear(&K);
 	}
 }
 
+/**
+ * Print the usage of the program
+ */
+void usage(char *name) {
+	printf("Usage: %s --encrypt file [--hybrid] [--threads N] [--stats|--stats-json]\n"
+		   "Usage: %s --decrypt file [--range OFFSET:LENGTH] [--threads N] [--stats|--stats-json]\n"
+		   "Usage: %s --generate-key-pair [--bits N] [--primes 2|3|4] [--threads N]\nUsage: %s --serve socket [--threads N] [--split]\n"
+		   "Usage: %s --serve-ring name [--slots N] [--threads N] [--split]\n"
+		   "Every mode also takes --arena or --arena-secure (per-thread GMP arenas, locked and wiped)\n\n",
+		   name, name, name, name, name);
+}
+
 int main(int argc, char** argv) {
-	// init time
-	srand(time(NULL));
+	int i, nb_threads, bits, nb_primes, generate, hybrid, nb_slots, stats, arena, split;
+	uint64_t start, len;
+	char *end;
 	
 	// checking number of arguments
-	if (argc > 3 || argc == 1) {
-		printf("Usage: %s --[decrypt, encrypt, generate-key-pair] file\nUsage: %s --generate-key-pair\n\n", argv[0], argv[0]);
+	generate = argc > 1 && strcmp(argv[1], "--generate-key-pair") == 0;
+	if (argc == 1 || (argc == 2 && !generate)) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	// options following the file (or the key pair generation)
+	nb_threads = 1;
+	bits 	   = RSA_DEFAULT_BITS;
+	nb_primes  = 2;
+	hybrid 	   = 0;
+	nb_slots   = SERVE_RING_SLOTS;
+	stats 	   = 0;
+	arena 	   = -1;
+	split 	   = 0;
+	start 	   = 0;
+	len 	   = UINT64_MAX;
+	for (i=(generate ? 2 : 3); i<argc; i++) {
+		if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+			nb_threads = atoi(argv[++i]);
+			if (nb_threads < 1) {
+				printf("Invalid number of threads: %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--arena") == 0) {
+			arena = 0;
+		} else if (strcmp(argv[i], "--arena-secure") == 0) {
+			arena = RSA_ALLOC_SECURE;
+		} else if (strcmp(argv[1], "--encrypt") == 0 && strcmp(argv[i], "--hybrid") == 0) {
+			hybrid = 1;
+		} else if ((strcmp(argv[1], "--encrypt") == 0 || strcmp(argv[1], "--decrypt") == 0)
+				   && (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats-json") == 0)) {
+			// 1: table, 2: JSON
+			stats = strcmp(argv[i], "--stats") == 0 ? 1 : 2;
+		} else if (strcmp(argv[1], "--decrypt") == 0 && strcmp(argv[i], "--range") == 0 && i+1 < argc) {
+			start = strtoull(argv[++i], &end, 10);
+			if (*end != ':' || *(end+1) == '\0') {
+				printf("Invalid range: %s (OFFSET:LENGTH)\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+			len = strtoull(end+1, &end, 10);
+			if (*end != '\0') {
+				printf("Invalid range: %s (OFFSET:LENGTH)\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if ((strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--serve-ring") == 0)
+				   && strcmp(argv[i], "--split") == 0) {
+			split = 1;
+		} else if (strcmp(argv[1], "--serve-ring") == 0 && strcmp(argv[i], "--slots") == 0 && i+1 < argc) {
+			nb_slots = atoi(argv[++i]);
+			if (nb_slots < 1 || nb_slots > (1 << 20)) {
+				printf("Invalid number of slots: %s\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else if (generate && strcmp(argv[i], "--bits") == 0 && i+1 < argc) {
+			bits = atoi(argv[++i]);
+			if (bits < RSA_MIN_BITS || bits > RSA_MAX_BITS) {
+				printf("Invalid modulus size: %s (%d to %d bits)\n", argv[i], RSA_MIN_BITS, RSA_MAX_BITS);
+				return EXIT_FAILURE;
+			}
+		} else if (generate && strcmp(argv[i], "--primes") == 0 && i+1 < argc) {
+			nb_primes = atoi(argv[++i]);
+			if (nb_primes < 2 || nb_primes > RSA_MAX_PRIMES) {
+				printf("Invalid number of primes: %s (2 to %d)\n", argv[i], RSA_MAX_PRIMES);
+				return EXIT_FAILURE;
+			}
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// before any GMP integer
+	if (-1 != arena && -1 == rsa_alloc_install(arena)) {
+		printf("%s\n", rsa_errmsg());
+		return EXIT_FAILURE;
+	}
+	
+	if (stats && -1 == rsa_stats_enable()) {
+		printf("%s\n", rsa_errmsg());
 		return EXIT_FAILURE;
 	}
 	
 	// for encryption
 	if (strcmp(argv[1], "--encrypt") == 0) {		
-		encrypt_file(argv[2]);
+		encrypt_file(argv[2], nb_threads, hybrid);
 	}
 	
 	// for decryption
 	else if (strcmp(argv[1], "--decrypt") == 0) {
-		decrypt_file(argv[2]);
+		decrypt_file(argv[2], nb_threads, start, len);
 	}
 	
 	// key pair generation
-	else if (strcmp(argv[1], "--generate-key-pair") == 0) {
-		key_pair();
+	else if (generate) {
+		key_pair(bits, nb_primes, nb_threads);
+	}
+	
+	// daemon
+	else if (strcmp(argv[1], "--serve") == 0) {
+		if (-1 == serve(argv[2], nb_threads, split)) {
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// daemon, shared memory
+	else if (strcmp(argv[1], "--serve-ring") == 0) {
+		if (-1 == serve_ring(argv[2], nb_slots, nb_threads, split)) {
+			return EXIT_FAILURE;
+		}
 	}
 	
 	// option not recognized
 	else {
-		printf("Usage: %s --[decrypt, encrypt, generate-key-pair] file\n", argv[0]);
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 	
+	if (stats) {
+		rsa_stats_print(stdout, stats == 2);
+	}
+	
 	return EXIT_SUCCESS;
 }
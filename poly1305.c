@@ -0,0 +1,245 @@
+/*
+ * File: poly1305.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "chacha20.h"
+#include "poly1305.h"
+
+#define MASK44 	0xfffffffffffULL
+#define MASK42 	0x3ffffffffffULL
+
+static uint64_t load64_le(const unsigned char *p) {
+	uint64_t v = 0;
+	int i;
+
+	for (i=7; i>=0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static void store64_le(unsigned char *p, uint64_t v) {
+	int i;
+
+	for (i=0; i<8; i++) {
+		p[i] = v >> (8*i);
+	}
+}
+
+/**
+ * Set up the key: r (clamped) | s
+ */
+void poly1305_init(struct poly1305 *mac, const unsigned char *key) {
+	uint64_t t0, t1;
+
+	t0 = load64_le(key);
+	t1 = load64_le(key + 8);
+
+	// r &= 0x0ffffffc0ffffffc0ffffffc0fffffff
+	mac->r[0] = t0 & 0xffc0fffffffULL;
+	mac->r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffffULL;
+	mac->r[2] = (t1 >> 24) & 0x00ffffffc0fULL;
+
+	mac->h[0] = mac->h[1] = mac->h[2] = 0;
+	mac->s[0] = load64_le(key + 16);
+	mac->s[1] = load64_le(key + 24);
+	mac->pending = 0;
+}
+
+/**
+ * Absorb nb_blocks blocks of 16 octets, hibit being 2^128 for whole
+ * blocks (0 for the padded last one)
+ */
+static void poly1305_blocks(struct poly1305 *mac, const unsigned char *m, size_t nb_blocks, uint64_t hibit) {
+	// vars
+	uint64_t r0 = mac->r[0], r1 = mac->r[1], r2 = mac->r[2];
+	uint64_t h0 = mac->h[0], h1 = mac->h[1], h2 = mac->h[2];
+	uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+	uint64_t t0, t1, c;
+	unsigned __int128 d0, d1, d2;
+
+	while (nb_blocks-- > 0) {
+		// h += m
+		t0 = load64_le(m);
+		t1 = load64_le(m + 8);
+		h0 += t0 & MASK44;
+		h1 += ((t0 >> 44) | (t1 << 20)) & MASK44;
+		h2 += ((t1 >> 24) & MASK42) | hibit;
+
+		// h *= r, the limbs above 2^130 folded back times 5
+		d0 = (unsigned __int128) h0 * r0 + (unsigned __int128) h1 * s2 + (unsigned __int128) h2 * s1;
+		d1 = (unsigned __int128) h0 * r1 + (unsigned __int128) h1 * r0 + (unsigned __int128) h2 * s2;
+		d2 = (unsigned __int128) h0 * r2 + (unsigned __int128) h1 * r1 + (unsigned __int128) h2 * r0;
+
+		// partial reduction
+		c = (uint64_t) (d0 >> 44); h0 = (uint64_t) d0 & MASK44;
+		d1 += c;
+		c = (uint64_t) (d1 >> 44); h1 = (uint64_t) d1 & MASK44;
+		d2 += c;
+		c = (uint64_t) (d2 >> 42); h2 = (uint64_t) d2 & MASK42;
+		h0 += c * 5;
+		c = h0 >> 44; h0 &= MASK44;
+		h1 += c;
+
+		m += 16;
+	}
+
+	mac->h[0] = h0;
+	mac->h[1] = h1;
+	mac->h[2] = h2;
+}
+
+/**
+ * Absorb len octets of message
+ */
+void poly1305_update(struct poly1305 *mac, const unsigned char *m, size_t len) {
+	size_t n;
+
+	// completing the pending block
+	if (mac->pending > 0) {
+		n = 16 - mac->pending < len ? 16 - mac->pending : len;
+		memcpy(mac->buffer + mac->pending, m, n);
+		mac->pending += n;
+		m 	+= n;
+		len -= n;
+		if (mac->pending < 16) {
+			return;
+		}
+		poly1305_blocks(mac, mac->buffer, 1, 1ULL << 40);
+		mac->pending = 0;
+	}
+
+	n = len & ~(size_t) 15;
+	poly1305_blocks(mac, m, n / 16, 1ULL << 40);
+	m 	+= n;
+	len -= n;
+
+	memcpy(mac->buffer, m, len);
+	mac->pending = len;
+}
+
+/**
+ * Write the tag (16 octets) and wipe the state
+ */
+void poly1305_finish(struct poly1305 *mac, unsigned char *tag) {
+	// vars
+	uint64_t h0, h1, h2, g0, g1, g2, c, mask;
+	unsigned __int128 t;
+
+	// last block, padded with 1 then zeros
+	if (mac->pending > 0) {
+		mac->buffer[mac->pending] = 1;
+		memset(mac->buffer + mac->pending + 1, 0, 16 - mac->pending - 1);
+		poly1305_blocks(mac, mac->buffer, 1, 0);
+	}
+
+	// full carry of h
+	h0 = mac->h[0]; h1 = mac->h[1]; h2 = mac->h[2];
+	c = h1 >> 44; h1 &= MASK44;
+	h2 += c; c = h2 >> 42; h2 &= MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+	h1 += c; c = h1 >> 44; h1 &= MASK44;
+	h2 += c; c = h2 >> 42; h2 &= MASK42;
+	h0 += c * 5; c = h0 >> 44; h0 &= MASK44;
+	h1 += c;
+
+	// g = h + 5 - 2^130, kept when h >= 2^130 - 5 (without branching)
+	g0 = h0 + 5; c = g0 >> 44; g0 &= MASK44;
+	g1 = h1 + c; c = g1 >> 44; g1 &= MASK44;
+	g2 = h2 + c - (1ULL << 42);
+
+	mask = (g2 >> 63) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+
+	// tag = h + s mod 2^128
+	t = (unsigned __int128) (h0 | (h1 << 44)) + mac->s[0];
+	store64_le(tag, (uint64_t) t);
+	t = (unsigned __int128) ((h1 >> 20) | (h2 << 24)) + mac->s[1] + (uint64_t) (t >> 64);
+	store64_le(tag + 8, (uint64_t) t);
+
+	memset(mac, 0, sizeof(*mac));
+}
+
+/**
+ * Poly1305 of aad | pad16 | buf | pad16 | len(aad) | len(buf), with the
+ * one-time key taken from keystream block 0 of (key, nonce)
+ */
+static void aead_tag(const unsigned char *key, const unsigned char *nonce,
+					 const unsigned char *aad, size_t aad_len,
+					 const unsigned char *buf, size_t len, unsigned char *tag) {
+	// vars
+	struct chacha20 cipher;
+	struct poly1305 mac;
+	unsigned char block[CHACHA20_BLOCK_SIZE], zeros[16], lengths[16];
+
+	chacha20_init(&cipher, key, nonce, 0);
+	chacha20_blocks(&cipher, block, 1);
+	poly1305_init(&mac, block);
+
+	memset(zeros, 0, sizeof(zeros));
+	store64_le(lengths, aad_len);
+	store64_le(lengths + 8, len);
+
+	poly1305_update(&mac, aad, aad_len);
+	poly1305_update(&mac, zeros, (16 - aad_len % 16) % 16);
+	poly1305_update(&mac, buf, len);
+	poly1305_update(&mac, zeros, (16 - len % 16) % 16);
+	poly1305_update(&mac, lengths, sizeof(lengths));
+	poly1305_finish(&mac, tag);
+
+	memset(&cipher, 0, sizeof(cipher));
+	memset(block, 0, sizeof(block));
+}
+
+/**
+ * AEAD_CHACHA20_POLY1305 (RFC 8439 section 2.8): encrypt buf in place
+ * (keystream from block 1) and write the tag of aad and the ciphertext
+ */
+void chacha20_poly1305_seal(const unsigned char *key, const unsigned char *nonce,
+							const unsigned char *aad, size_t aad_len,
+							unsigned char *buf, size_t len, unsigned char *tag) {
+	struct chacha20 cipher;
+
+	chacha20_init(&cipher, key, nonce, 1);
+	chacha20_xor(&cipher, buf, buf, len);
+	memset(&cipher, 0, sizeof(cipher));
+
+	aead_tag(key, nonce, aad, aad_len, buf, len, tag);
+}
+
+/**
+ * Check the tag of aad and the ciphertext buf, then decrypt buf in place
+ *
+ * return -1 if the tag does not match (buf is left as it was)
+ */
+int chacha20_poly1305_open(const unsigned char *key, const unsigned char *nonce,
+						   const unsigned char *aad, size_t aad_len,
+						   unsigned char *buf, size_t len, const unsigned char *tag) {
+	// vars
+	struct chacha20 cipher;
+	unsigned char expected[POLY1305_TAG_SIZE];
+	unsigned char diff;
+	int i;
+
+	aead_tag(key, nonce, aad, aad_len, buf, len, expected);
+
+	// in constant time
+	diff = 0;
+	for (i=0; i<POLY1305_TAG_SIZE; i++) {
+		diff |= expected[i] ^ tag[i];
+	}
+	if (diff != 0) {
+		return -1;
+	}
+
+	chacha20_init(&cipher, key, nonce, 1);
+	chacha20_xor(&cipher, buf, buf, len);
+	memset(&cipher, 0, sizeof(cipher));
+	return 0;
+}
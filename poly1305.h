@@ -0,0 +1,37 @@
+/*
+ * File: poly1305.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_POLY1305_
+#define _H_POLY1305_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POLY1305_KEY_SIZE 	32
+#define POLY1305_TAG_SIZE 	16
+
+/**
+ * Poly1305 (RFC 8439): h = (h + block) * r mod 2^130 - 5, in 3 limbs
+ * of 44, 44 and 42 bits, the tag being h + s mod 2^128
+ */
+struct poly1305 {
+	uint64_t r[3], h[3];
+	uint64_t s[2];
+	unsigned char buffer[16]; 	// pending partial block
+	size_t pending;
+};
+
+void poly1305_init(struct poly1305 *mac, const unsigned char *key);
+void poly1305_update(struct poly1305 *mac, const unsigned char *m, size_t len);
+void poly1305_finish(struct poly1305 *mac, unsigned char *tag);
+
+void chacha20_poly1305_seal(const unsigned char *key, const unsigned char *nonce,
+							const unsigned char *aad, size_t aad_len,
+							unsigned char *buf, size_t len, unsigned char *tag);
+int chacha20_poly1305_open(const unsigned char *key, const unsigned char *nonce,
+						   const unsigned char *aad, size_t aad_len,
+						   unsigned char *buf, size_t len, const unsigned char *tag);
+
+#endif // _H_POLY1305_
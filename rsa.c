@@ -8,68 +8,592 @@
 #include <time.h>
 #include <gmp.h>
 #include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
-#define MOD_LENGTH 	2048
-#define MIN 		5000
-#define MAX 		50000
+#include "rsa_error.h"
+#include "rsa.h"
+#include "rsa_rand.h"
+#include "rsa_stats.h"
+#include "rsa_mb.h"
+#include "rsa_mont.h"
+#include "rsa_split.h"
+
+// prime search: small primes used by the sieve, candidates per window
+#define SIEVE_PRIMES 	16384
+#define SIEVE_WINDOW 	8192
+#define SIEVE_BOUND 	(1 << 18) 	// above the SIEVE_PRIMES-th odd prime
+
+static unsigned int small_primes[SIEVE_PRIMES];
+
+/**
+ * One prime searched by several threads, the first one to find it
+ * sets found and the others stop
+ */
+struct prime_search {
+	mpz_t prime;
+	int length;
+	int found;
+	pthread_mutex_t lock;
+};
+
+/**
+ * Fill small_primes with the first SIEVE_PRIMES odd primes, with a
+ * sieve of Eratosthenes over the odd numbers below SIEVE_BOUND
+ */
+static void init_small_primes(void) {
+	// composite[i] for 2i+1, only used once
+	static unsigned char composite[SIEVE_BOUND / 2];
+	unsigned int i, j, count;
+	
+	count = 0;
+	for (i=1; i<SIEVE_BOUND/2 && count<SIEVE_PRIMES; i++) {
+		if (composite[i]) {
+			continue;
+		}
+		
+		small_primes[count++] = 2*i + 1;
+		for (j=2*i*(i+1); j<SIEVE_BOUND/2; j+=2*i+1) {
+			composite[j] = 1;
+		}
+	}
+}
+
+/**
+ * Number of Miller-Rabin rounds for a random candidate of 'bits' bits,
+ * for an error probability below 2^-128 (as chosen by OpenSSL)
+ */
+int miller_rabin_rounds(int bits) {
+	if (bits >= 3747) return 3;
+	if (bits >= 1345) return 4;
+	if (bits >= 476)  return 5;
+	if (bits >= 400)  return 6;
+	if (bits >= 347)  return 7;
+	if (bits >= 308)  return 8;
+	if (bits >= 55)   return 27;
+	return 34;
+}
+
+/**
+ * Miller-Rabin test of an odd n > 3: base 2 first, then random bases
+ * 
+ * return 1 if n is probably prime, 0 if composite
+ */
+int miller_rabin(mpz_t n, int rounds, gmp_randstate_t rs) {
+	// vars
+	mpz_t n1, d, a, x;
+	mp_bitcnt_t s, j;
+	int i, prime;
+	
+	mpz_inits(n1, d, a, x, NULL);
+	
+	// n - 1 = d * 2^s, d odd
+	mpz_sub_ui(n1, n, 1);
+	s = mpz_scan1(n1, 0);
+	mpz_tdiv_q_2exp(d, n1, s);
+	
+	prime = 1;
+	for (i=0; i<rounds && prime; i++) {
+		// a in [2, n-2]
+		if (0 == i) {
+			mpz_set_ui(a, 2);
+		} else {
+			mpz_sub_ui(a, n, 3);
+			mpz_urandomm(a, rs, a);
+			mpz_add_ui(a, a, 2);
+		}
+		
+		// x = a^d mod n must be 1, or reach n - 1 by squaring
+		mpz_powm(x, a, d, n);
+		if (mpz_cmp_ui(x, 1) == 0 || mpz_cmp(x, n1) == 0) {
+			continue;
+		}
+		
+		prime = 0;
+		for (j=1; j<s && !prime; j++) {
+			mpz_powm_ui(x, x, 2, n);
+			prime = mpz_cmp(x, n1) == 0;
+		}
+	}
+	
+	mpz_clears(n1, d, a, x, NULL);
+	return prime;
+}
+
+/**
+ * Search a prime with a bit length of 'length' (two top bits set, so
+ * that the product of two of them has exactly 2*length bits), until one
+ * is found or *cancel is set
+ *
+ * The odd candidates base + 2j, j < SIEVE_WINDOW, are sieved by the
+ * small primes: the residues of base are computed once, then moved
+ * along from one window to the next. The survivors go through
+ * Miller-Rabin.
+ * 
+ * return -1 if the search was cancelled or memory is missing
+ */
+int search_prime(mpz_t prime, int length, gmp_randstate_t rs, int *cancel) {
+	// vars
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	unsigned int *residues, r, j;
+	unsigned char *sieve;
+	mpz_t base;
+	int i, status, rounds;
+	
+	// small lengths: nothing to sieve
+	if (length < 32) {
+		do {
+			mpz_urandomb(prime, rs, length);
+			mpz_setbit(prime, length-1);
+			mpz_nextprime(prime, prime);
+		} while (mpz_sizeinbase(prime, 2) != length);
+		return 0;
+	}
+	
+	pthread_once(&once, init_small_primes);
+	rounds 	 = miller_rabin_rounds(length);
+	residues = malloc(SIEVE_PRIMES * sizeof(*residues));
+	sieve 	 = malloc(SIEVE_WINDOW);
+	if (NULL == residues || NULL == sieve) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		free(residues);
+		free(sieve);
+		return -1;
+	}
+	
+	mpz_init(base);
+	status = -1;
+	while (status == -1 && !__atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+		// Randomization: odd, two top bits set
+		mpz_urandomb(base, rs, length);
+		mpz_setbit(base, length-1);
+		mpz_setbit(base, length-2);
+		mpz_setbit(base, 0);
+		
+		for (i=0; i<SIEVE_PRIMES; i++) {
+			residues[i] = mpz_fdiv_ui(base, small_primes[i]);
+		}
+		
+		// windows until the candidates overflow 'length' bits
+		while (status == -1 && !__atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+			// crossing the multiples of each small prime out:
+			// base + 2j = 0 mod r  <=>  j = -residue * 2^(-1) mod r
+			memset(sieve, 1, SIEVE_WINDOW);
+			for (i=0; i<SIEVE_PRIMES; i++) {
+				r = small_primes[i];
+				j = (unsigned int) (((unsigned long) (r - residues[i]) % r * ((r + 1) / 2)) % r);
+				for (; j<SIEVE_WINDOW; j+=r) {
+					sieve[j] = 0;
+				}
+			}
+			
+			for (j=0; j<SIEVE_WINDOW; j++) {
+				if (!sieve[j]) {
+					continue;
+				}
+				
+				mpz_add_ui(prime, base, 2*j);
+				if (mpz_sizeinbase(prime, 2) != length) {
+					break;
+				}
+				
+				if (miller_rabin(prime, rounds, rs)) {
+					status = 0;
+					break;
+				}
+				
+				if (__atomic_load_n(cancel, __ATOMIC_RELAXED)) {
+					break;
+				}
+			}
+			
+			if (j < SIEVE_WINDOW) {
+				// found, cancelled or out of range: new base
+				break;
+			}
+			
+			// next window
+			mpz_add_ui(base, base, 2*SIEVE_WINDOW);
+			for (i=0; i<SIEVE_PRIMES; i++) {
+				residues[i] = (residues[i] + 2*SIEVE_WINDOW) % small_primes[i];
+			}
+		}
+	}
+	
+	mpz_clear(base);
+	free(residues);
+	free(sieve);
+	return status;
+}
 
 /**
  * Generate a prime with a bit length of 'length'
+ *
+ * return -1 on failure, see rsa_errmsg()
  */
-void generate_prime(mpz_t prime, int length) {
+int generate_prime(mpz_t prime, int length) {
 	// vars
 	gmp_randstate_t rs;
+	int cancel = 0, status;
 	
 	// Initializing rs
 	gmp_randinit_default(rs);
 	
 	// Seeding the random state
-	gmp_randseed_ui(rs, (rand() % MAX) + MIN);
+	status = rand_seed_gmp(rs);
+	if (status == 0) {
+		status = search_prime(prime, length, rs, &cancel);
+	}
+	
+	gmp_randclear(rs);
+	return status;
+}
+
+/**
+ * Searches taken by one thread, one after the other: search[first],
+ * search[first + step], ... below count
+ */
+struct prime_worker {
+	struct prime_search *search;
+	int first, step, count;
+};
+
+/**
+ * Thread of prime_searches: the first prime found of each is kept
+ * Each thread seeds its own random state, so it has its own random
+ * starting point
+ */
+static void * prime_thread(void *arg) {
+	// vars
+	struct prime_worker *worker = arg;
+	struct prime_search *search;
+	gmp_randstate_t rs;
+	mpz_t candidate;
+	int i;
+	
+	mpz_init(candidate);
+	gmp_randinit_default(rs);
+	
+	if (rand_seed_gmp(rs) == 0) {
+		for (i=worker->first; i<worker->count; i+=worker->step) {
+			search = &worker->search[i];
+			if (search_prime(candidate, search->length, rs, &search->found) == -1) {
+				// found by another thread, or failed: the rest is left
+				// unsearched and reported by search_primes_mt
+				if (!__atomic_load_n(&search->found, __ATOMIC_RELAXED)) {
+					break;
+				}
+				continue;
+			}
+			
+			pthread_mutex_lock(&search->lock);
+			if (!search->found) {
+				mpz_set(search->prime, candidate);
+				__atomic_store_n(&search->found, 1, __ATOMIC_RELAXED);
+			}
+			pthread_mutex_unlock(&search->lock);
+		}
+	}
+	
+	gmp_randclear(rs);
+	mpz_clear(candidate);
+	return NULL;
+}
+
+/**
+ * Generate count primes at the same time, primes[i] with a bit length
+ * of lengths[i]. The threads are split between the primes, each one
+ * searching from its own random starting point; with fewer threads
+ * than primes, each thread searches several primes in turn.
+ *
+ * return -1 if the threads could not be created or every thread of a
+ * prime failed
+ */
+static int search_primes_mt(mpz_ptr *primes, int *lengths, int count, int nb_threads) {
+	// vars
+	struct prime_search search[RSA_MAX_PRIMES];
+	struct prime_worker *workers;
+	pthread_t *threads;
+	int i, started, found;
+	
+	threads = malloc(nb_threads * sizeof(*threads));
+	workers = malloc(nb_threads * sizeof(*workers));
+	if (NULL == threads || NULL == workers) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		free(threads);
+		free(workers);
+		return -1;
+	}
+	
+	for (i=0; i<count; i++) {
+		mpz_init(search[i].prime);
+		search[i].length = lengths[i];
+		search[i].found  = 0;
+		pthread_mutex_init(&search[i].lock, NULL);
+	}
 	
-	// Randomization
-	mpz_urandomb(prime, rs, length);
+	// thread t searches prime t mod count, then t + nb_threads, ... when
+	// there are fewer threads than primes
+	for (started=0; started<nb_threads; started++) {
+		workers[started].search = search;
+		workers[started].first 	= started % count;
+		workers[started].step 	= nb_threads < count ? nb_threads : count;
+		workers[started].count 	= count;
+		if (pthread_create(&threads[started], NULL, prime_thread, &workers[started]) != 0) {
+			break;
+		}
+	}
+	
+	// a thread is missing: cancelling
+	if (started < nb_threads) {
+		rsa_error(RSA_ETHREAD, "Unable to create a key generation thread.");
+		for (i=0; i<count; i++) {
+			__atomic_store_n(&search[i].found, 1, __ATOMIC_RELAXED);
+		}
+	}
+	
+	for (i=0; i<started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	
+	// the threads report their errors in their own rsa_errmsg()
+	for (i=0, found=1; i<count; i++) {
+		found = found && search[i].found;
+	}
+	if (started == nb_threads && !found) {
+		rsa_error(RSA_ENOMEM, "A key generation thread failed.");
+		started = 0;
+	}
+	
+	for (i=0; i<count; i++) {
+		mpz_set(primes[i], search[i].prime);
+		mpz_clear(search[i].prime);
+		pthread_mutex_destroy(&search[i].lock);
+	}
+	free(threads);
+	free(workers);
+	
+	return started < nb_threads ? -1 : 0;
+}
+
+/**
+ * Generate the primes p and q at the same time, with a bit length of
+ * 'length'. The threads are split between p and q, each one searching
+ * from its own random starting point.
+ *
+ * return -1 if the threads could not be created or every thread of a
+ * prime failed
+ */
+int generate_primes_mt(mpz_t p, mpz_t q, int length, int nb_threads) {
+	mpz_ptr primes[] = { p, q };
+	int lengths[] 	 = { length, length };
+	
+	return search_primes_mt(primes, lengths, 2, nb_threads);
+}
+
+/**
+ * Initialize every integer of a private key
+ */
+void rsa_priv_init(struct rsa_priv *K) {
+	int i;
 	
-	// Check if prime
-	while (mpz_probab_prime_p(prime, 5) == 0) {
-		mpz_nextprime(prime, prime);
+	mpz_inits(K->n, K->d, K->p, K->q, K->dP, K->dQ, K->qInv, NULL);
+	for (i=0; i<RSA_MAX_PRIMES-2; i++) {
+		mpz_inits(K->r[i], K->di[i], K->ti[i], NULL);
+	}
+	K->crt = 0;
+	K->u   = 2;
+	K->map = NULL;
+	K->map_len = 0;
+}
+
+/**
+ * Clear every integer of a private key
+ * A key mapped from a binary key file is unmapped instead
+ */
+void rsa_priv_clear(struct rsa_priv *K) {
+	int i;
+	
+	if (NULL != K->map) {
+		munmap(K->map, K->map_len);
+		K->map = NULL;
+	} else {
+		mpz_clears(K->n, K->d, K->p, K->q, K->dP, K->dQ, K->qInv, NULL);
+		for (i=0; i<RSA_MAX_PRIMES-2; i++) {
+			mpz_clears(K->r[i], K->di[i], K->ti[i], NULL);
+		}
 	}
+	K->crt = 0;
+	K->u   = 2;
 }
 
 /**
- * Generate a key pair (n, e) and (n, d)
- * The return value: [n, e, d]
+ * Compute n, d and the CRT values (dP, dQ, qInv) from the primes
+ * p and q already stored in K and the public exponent e.
+ * A multi-prime key (K->u > 2) also gets its triplets (r_i, d_i, t_i)
+ * from the primes r_i stored in K->r.
+ *
+ * return -1 if e is not invertible modulo one of the r_i - 1
  */
-void generate_keypair(mpz_t n, mpz_t e, mpz_t d) {
-	// Vars
-	mpz_t p, q;
+int rsa_priv_derive(struct rsa_priv *K, mpz_t e) {
+	// vars
 	mpz_t p1, q1;
 	mpz_t lambda; // totient, according to PKCS#1
+	mpz_t R; 	  // r_1 * ... * r_(i-1)
+	int status, i;
 	
-	// Assigning
-	// With p and q of 512bits, the modulus will be 1024bits
-	mpz_inits(p, q, NULL);
-	generate_prime(p, MOD_LENGTH/2); 
-	generate_prime(q, MOD_LENGTH/2);
-	
-	mpz_inits(p1, q1, n, NULL);
-	mpz_mul(n, p, q); 		// n = p * q
-	mpz_sub_ui(p1, p, 1); 	// p1 = p-1
-	mpz_sub_ui(q1, q, 1); 	// q1 = q-1
-	mpz_clears(p, q, NULL);
+	mpz_inits(p1, q1, lambda, R, NULL);
+	mpz_mul(K->n, K->p, K->q); 	// n = p * q
+	mpz_sub_ui(p1, K->p, 1); 	// p1 = p-1
+	mpz_sub_ui(q1, K->q, 1); 	// q1 = q-1
 	
 	// totient
-	mpz_init(lambda);
 	mpz_lcm(lambda, p1, q1); // lambda = lcm(p-1, q-1);
-	mpz_clears(p1, q1, NULL);
 	
-	// popular choice for the public exponents is e = 65537
-	mpz_set_ui(e, 65537);
+	// n = r_1 * ... * r_u, lambda = lcm(r_1 - 1, ..., r_u - 1)
+	for (i=0; i<K->u-2; i++) {
+		mpz_mul(K->n, K->n, K->r[i]);
+		mpz_sub_ui(p1, K->r[i], 1);
+		mpz_lcm(lambda, lambda, p1);
+	}
+	mpz_sub_ui(p1, K->p, 1);
 	
 	// d = e^(-1) mod lambda
-	mpz_invert(d, e, lambda);
+	// dP = e^(-1) mod (p-1), dQ = e^(-1) mod (q-1), qInv = q^(-1) mod p
+	status = 0;
+	if (mpz_invert(K->d, e, lambda) == 0
+		|| mpz_invert(K->dP, e, p1) == 0
+		|| mpz_invert(K->dQ, e, q1) == 0
+		|| mpz_invert(K->qInv, K->q, K->p) == 0) {
+		status = -1;
+	}
+	
+	// d_i = e^(-1) mod (r_i - 1), t_i = (r_1 * ... * r_(i-1))^(-1) mod r_i
+	mpz_mul(R, K->p, K->q);
+	for (i=0; i<K->u-2 && status == 0; i++) {
+		mpz_sub_ui(p1, K->r[i], 1);
+		if (mpz_invert(K->di[i], e, p1) == 0
+			|| mpz_invert(K->ti[i], R, K->r[i]) == 0) {
+			status = -1;
+		}
+		mpz_mul(R, R, K->r[i]);
+	}
+	K->crt = (status == 0);
 	
 	// Clearing
-	mpz_clear(lambda);
+	mpz_clears(p1, q1, lambda, R, NULL);
+	return status;
+}
+
+/**
+ * Generate a key pair (n, e) and (n, d) with a modulus of 'bits' bits
+ * and nb_primes primes (2 to RSA_MAX_PRIMES, of at least
+ * RSA_MIN_PRIME_BITS bits each). The private key also keeps the primes
+ * and the CRT values. With nb_threads > 1, the primes are searched at
+ * the same time.
+ *
+ * return -1 on failure, see rsa_errmsg()
+ */
+int generate_keypair_multi(mpz_t e, struct rsa_priv *K, int bits, int nb_primes, int nb_threads) {
+	// vars
+	mpz_ptr primes[RSA_MAX_PRIMES];
+	int lengths[RSA_MAX_PRIMES];
+	int i, j, distinct;
+	
+	if (2 == nb_primes) {
+		return generate_keypair(e, K, bits, nb_threads);
+	}
+	
+	if (nb_primes < 2 || nb_primes > RSA_MAX_PRIMES || bits / nb_primes < RSA_MIN_PRIME_BITS) {
+		rsa_error(RSA_EINVAL, "Unsupported number of primes: %d for %d bits", nb_primes, bits);
+		return -1;
+	}
+	
+	// popular choice for the public exponents is e = 65537
+	mpz_set_ui(e, 65537);
+	
+	// the first primes get the extra bits of a size that does not divide
+	K->u = nb_primes;
+	primes[0] = K->p;
+	primes[1] = K->q;
+	for (i=0; i<nb_primes; i++) {
+		lengths[i] = bits / nb_primes + (i < bits % nb_primes);
+		if (i >= 2) {
+			primes[i] = K->r[i-2];
+		}
+	}
+	
+	// with two top bits set, the product of u primes may miss the top bit
+	// of n: the last prime is searched again until n has 'bits' bits
+	// Restarting until the primes are distinct and e is invertible
+	// modulo each r_i - 1
+	do {
+		if (nb_threads < 2 || search_primes_mt(primes, lengths, nb_primes, nb_threads) == -1) {
+			for (i=0; i<nb_primes; i++) {
+				if (generate_prime(primes[i], lengths[i]) == -1) {
+					return -1;
+				}
+			}
+		}
+		
+		for (;;) {
+			mpz_set(K->n, primes[0]);
+			for (i=1; i<nb_primes; i++) {
+				mpz_mul(K->n, K->n, primes[i]);
+			}
+			if (mpz_sizeinbase(K->n, 2) == bits) {
+				break;
+			}
+			if (generate_prime(primes[nb_primes-1], lengths[nb_primes-1]) == -1) {
+				return -1;
+			}
+		}
+		
+		distinct = 1;
+		for (i=0; i<nb_primes; i++) {
+			for (j=i+1; j<nb_primes; j++) {
+				distinct = distinct && mpz_cmp(primes[i], primes[j]) != 0;
+			}
+		}
+	} while (!distinct || rsa_priv_derive(K, e) == -1);
+	
+	return 0;
+}
+
+/**
+ * Generate a two-prime key pair (n, e) and (n, d) with a modulus of
+ * 'bits' bits
+ * The private key also keeps p, q and the CRT values
+ * With nb_threads > 1, p and q are searched at the same time
+ *
+ * return -1 on failure, see rsa_errmsg()
+ */
+int generate_keypair(mpz_t e, struct rsa_priv *K, int bits, int nb_threads) {
+	// popular choice for the public exponents is e = 65537
+	mpz_set_ui(e, 65537);
+	K->u = 2;
+	
+	// p and q have their two top bits set, so that n has exactly
+	// 'bits' bits: p gets the extra bit of an odd size
+	// Restarting until e is invertible modulo p-1 and q-1
+	do {
+		if (nb_threads < 2 || bits % 2 != 0
+			|| generate_primes_mt(K->p, K->q, bits/2, nb_threads) == -1) {
+			if (generate_prime(K->p, bits - bits/2) == -1
+				|| generate_prime(K->q, bits/2) == -1) {
+				return -1;
+			}
+		}
+	} while (mpz_cmp(K->p, K->q) == 0 || rsa_priv_derive(K, e) == -1);
+	
+	return 0;
+}
+
+/**
+ * Length in octets of the modulus n (k in PKCS#1)
+ */
+int rsa_octets(mpz_t n) {
+	return (mpz_sizeinbase(n, 2) + 7) / 8;
 }
 
 /**
@@ -81,58 +605,27 @@ void generate_keypair(mpz_t n, mpz_t e, mpz_t d) {
  *  xLen     intended length of the resulting octet string
  *
  * Output:
- *  X        corresponding octet string of length xLen
+ *  X        corresponding octet string of length xLen, written into
+ *           the caller's buffer
  *
  * Error: "integer too large"
  */
-unsigned char * i2osp(mpz_t x, int xLen) {
+int i2osp(unsigned char *X, mpz_t x, int xLen) {
 	// vars
-	mpz_t pow256, q, r, x_copy;
-	unsigned char temp, *X;
-	int i;
-	
-	// init
-	mpz_init(pow256);
-	mpz_ui_pow_ui(pow256, 256, xLen);
+	size_t len;
 	
 	// length checking
-	mpz_clear(pow256);
-	if (mpz_cmp(x, pow256) >= 0) {
-		printf("Integer too large\n");
-		return NULL;
-	}
-		
-	// setting initial values
-	mpz_init(x_copy);
-	mpz_set(x_copy, x);
-
-	X = (unsigned char *) malloc(xLen * sizeof(unsigned char *));
-	if (NULL == X) {
-		printf("Memory error.\n");
-		mpz_clear(x_copy);
-		exit(1);
-	}
-	
-	memset(X, '\0', sizeof(X));
-	
-	i = xLen - 1;
-	mpz_inits(q, r, NULL);
-	while (mpz_cmp_d(x_copy, 256) > 0) {
-		 mpz_tdiv_q_ui(q, x_copy, 256);
-		 mpz_tdiv_r_ui(r, x_copy, 256);
-		 
-		 X[i] = (unsigned char) mpz_get_ui(r);
-		 i--;
-		 
-		 mpz_set(x_copy, q);
+	len = mpz_sgn(x) == 0 ? 0 : (mpz_sizeinbase(x, 2) + 7) / 8;
+	if (len > xLen) {
+		rsa_error(RSA_EINVAL, "Integer too large");
+		return -1;
 	}
-	mpz_clears(r, x_copy, NULL);
 	
-	// appending the rest
-	X[i] = (unsigned char) mpz_get_d(q);
+	// leading zero octets, then x in big-endian order
+	memset(X, 0, xLen - len);
+	mpz_export(X + xLen - len, NULL, 1, 1, 1, 0, x);
 	
-	mpz_clear(q);
-	return X;
+	return 0;
 } 
 
 /**
@@ -145,30 +638,8 @@ unsigned char * i2osp(mpz_t x, int xLen) {
  *  x        corresponding nonnegative integer 
  */
 void os2ip(mpz_t x, unsigned char *X, size_t xLen) {
-	// vars
-	int i;
-	mpz_t x_i, pow256;
-	
-	// checking x (must be 0)
-	mpz_set_ui(x, 0);
-	
-	// assigning
-	mpz_inits(x_i, pow256, NULL);
-	
-	// summing
-	for (i=xLen; i>0; i--) {	
-		// 256 ^ i
-		mpz_ui_pow_ui(pow256, 256, xLen-i); 
-		
-		// x_i * 256^i
-		mpz_mul_ui(x_i, pow256, (unsigned char) X[i-1]);
-		
-		// adding to the result
-		mpz_add(x, x, x_i);
-	}
-	
-	// clearing
-	mpz_clears(x_i, pow256, NULL);
+	// X is read as one big-endian integer
+	mpz_import(x, xLen, 1, 1, 1, 0, X);
 }
 
 /**
@@ -187,6 +658,7 @@ int rsaep(mpz_t cipher, mpz_t n, mpz_t e, mpz_t message) {
 	// If the message representative m is not between 0 and n - 1, output
     // "message representative out of range" and stop.
     mpz_t sub;
+    struct rsa_mont M;
     int comp1, comp2;
     
     // Initialization
@@ -199,7 +671,7 @@ int rsaep(mpz_t cipher, mpz_t n, mpz_t e, mpz_t message) {
     
     // Checking message length
     if (comp1 < 0 || comp2 > 0) {
-		printf("Message representative out of range\n");
+		rsa_error(RSA_EINVAL, "Message representative out of range");
 		mpz_clear(sub);
 		return -1;
 	}
@@ -207,12 +679,40 @@ int rsaep(mpz_t cipher, mpz_t n, mpz_t e, mpz_t message) {
 	// Clearing sub
 	mpz_clear(sub);
 	
-	// Let c = m^e mod n
-	mpz_powm(cipher, message, e, n);
+	// Let c = m^e mod n, a small e through the kernel of n
+	if (!mpz_fits_ulong_p(e) || -1 == mont_init(&M, n)
+		|| -1 == mont_powm_ui(cipher, message, mpz_get_ui(e), &M)) {
+		mpz_powm(cipher, message, e, n);
+	}
+	mont_clear(&M);
 	
 	return 0;
 }
 
+/**
+ * r = b^e mod m, through the fixed-size kernel of M when there is one
+ * (M may be NULL)
+ */
+static void rsa_powm(mpz_t r, mpz_t b, mpz_t e, mpz_t m, struct rsa_mont *M) {
+	if (NULL == M || -1 == mont_powm(r, b, e, M)) {
+		mpz_powm(r, b, e, m);
+	}
+}
+
+/**
+ * Prime r_(i+1) of K: p, q, then the r_i of the triplets
+ */
+static inline mpz_ptr crt_prime(struct rsa_priv *K, int i) {
+	return 0 == i ? K->p : 1 == i ? K->q : K->r[i-2];
+}
+
+/**
+ * CRT exponent of r_(i+1): dP, dQ, then the d_i of the triplets
+ */
+static inline mpz_ptr crt_exp(struct rsa_priv *K, int i) {
+	return 0 == i ? K->dP : 1 == i ? K->dQ : K->di[i-2];
+}
+
 /**
  * Input:
  *  K        RSA private key, where K has one of the following forms:
@@ -228,242 +728,735 @@ int rsaep(mpz_t cipher, mpz_t n, mpz_t e, mpz_t message) {
  *
  * Assumption: RSA private key K is valid
  */
-int rsadp(mpz_t message, mpz_t n, mpz_t d, mpz_t cipher) {
-	mpz_t sub;
-	int comp1, comp2;
+int rsadp(mpz_t message, struct rsa_priv *K, mpz_t cipher) {
+	mpz_t sub, mi[RSA_MAX_PRIMES];
+	int comp1, comp2, i;
 	
 	// initialization
 	mpz_init(sub);
 	
 	// setting values
-	mpz_sub_ui(sub, n, 1);
+	mpz_sub_ui(sub, K->n, 1);
 	comp1 = mpz_cmp_ui(cipher, 0);
 	comp2 = mpz_cmp(cipher, sub);
 	mpz_clear(sub);
 	
 	// Checking cipher representative
 	if (comp1 < 0 || comp2 > 0) {
-		printf("Cipher representative out of range\n");
+		rsa_error(RSA_EINVAL, "Cipher representative out of range");
 		return -1;
 	}
 	
-	// Let m = c^d mod n
-	mpz_powm(message, cipher, d, n);
+	// (n, d) form: let m = c^d mod n
+	if (!K->crt) {
+		mpz_powm(message, cipher, K->d, K->n);
+		return 0;
+	}
+	
+	// (p, q, dP, dQ, qInv) form, and the triplets of a multi-prime key
+	// (the Montgomery constants are only worth it in a context)
+	for (i=0; i<K->u; i++) {
+		mpz_init(mi[i]);
+	}
+	rsadp_crt(message, K, cipher, mi, NULL);
+	for (i=0; i<K->u; i++) {
+		mpz_clear(mi[i]);
+	}
+	
 	return 0;
 }
 
 /**
- * Input:
- *  (n, e)   recipient's RSA public key (k denotes the length in octets
- *           of the modulus n)
- *  M        message to be encrypted, an octet string of length mLen,
- *           where mLen <= k - 11
- *
- * Output:
- *  C        ciphertext, an octet string of length k
- *
- * Error: "message too long"
+ * mi[i] = c^d_(i+1) mod r_(i+1) for i = first, first + step, ... < u
+ * The ciphertext of a multi-prime key is reduced first, so that the
+ * fixed-size kernels take it
  */
-unsigned char * rsaes_pkcs1_encrypt(mpz_t n, mpz_t e, unsigned char *M) {
-	// vars
-	int mLen, k;
-	unsigned char *PS, *EM, *C;
-	gmp_randstate_t rs;
-	mpz_t m, c;
-	FILE *fp_encrypted;
-	int i, step, count;
-	
-	// assigning	
-	mLen = strlen(M);
-	k 	 = mpz_size(n) * GMP_LIMB_BITS / 8;
+static void crt_powers(struct rsa_priv *K, mpz_t cipher, mpz_t *mi, struct rsa_mont *M, int first, int step) {
+	int i;
 	
-	// length checking 
-	if (mLen > (k-11)) {
-		printf("Message too large\n");
-		return NULL;
+	for (i=first; i<K->u; i+=step) {
+		if (2 == K->u) {
+			rsa_powm(mi[i], cipher, crt_exp(K, i), crt_prime(K, i), NULL == M ? NULL : &M[i]);
+			continue;
+		}
+		mpz_mod(mi[i], cipher, crt_prime(K, i));
+		rsa_powm(mi[i], mi[i], crt_exp(K, i), crt_prime(K, i), NULL == M ? NULL : &M[i]);
 	}
+}
+
+/**
+ * Garner's recombination of the m_i = c^d_i mod r_i held by mi (which
+ * is overwritten)
+ */
+static void crt_garner(mpz_t message, struct rsa_priv *K, mpz_t *mi) {
+	int i;
 	
-	// allocating PS
-	PS = malloc((k - mLen - 3) * sizeof(unsigned char *));
-	if (NULL == PS) {
-		printf("Memory error.\n");
-		exit(1);
-	}
-	memset(PS, '\0', k-mLen-3);
+	// Let h = (m_1 - m_2) * qInv mod p
+	mpz_sub(mi[0], mi[0], mi[1]);
+	mpz_mul(mi[0], mi[0], K->qInv);
+	mpz_mod(mi[0], mi[0], K->p);
 	
-	// Generate an octet string PS of length k - mLen - 3 consisting
-    // of pseudo-randomly generated nonzero octets.  The length of PS
-    // will be at least eight octets.
-    count = 0;
-	for (i=0; i<(k-mLen-3); i++) {
-		PS[i] = rand() % 255 + 1;
+	// Let m = m_2 + q * h
+	mpz_mul(message, K->q, mi[0]);
+	mpz_add(message, message, mi[1]);
+	
+	// Let R = r_1, then for i = 3, ..., u:
+	// R = R * r_(i-1), h = (m_i - m) * t_i mod r_i, m = m + R * h
+	if (K->u > 2) {
+		mpz_set(mi[0], K->p);
+	}
+	for (i=2; i<K->u; i++) {
+		mpz_mul(mi[0], mi[0], crt_prime(K, i-1));
+		mpz_sub(mi[i], mi[i], message);
+		mpz_mul(mi[i], mi[i], K->ti[i-2]);
+		mpz_mod(mi[i], mi[i], K->r[i-2]);
+		mpz_addmul(message, mi[0], mi[i]);
 	}
+}
 
-	EM = malloc(k * sizeof(unsigned char *));
-	if (NULL == EM) {
-		printf("Memory error.\n");
-		exit(1);
-	}//
-	memset(EM, '\0', k);
-    
-    // Concatenate PS, the message M, and other padding to form an
-    // encoded message EM of length k octets as
-	// EM = 00 | 02 | PS | 00 | M
+/**
+ * RSADP with the quintuple (p, q, dP, dQ, qInv) of K and its triplets
+ * mi are K->u scratch integers provided by the caller, M the Montgomery
+ * constants of the primes (or NULL)
+ */
+void rsadp_crt(mpz_t message, struct rsa_priv *K, mpz_t cipher, mpz_t *mi, struct rsa_mont *M) {
+	// Let m_i = c^d_i mod r_i (m_1 = c^dP mod p, m_2 = c^dQ mod q)
+	crt_powers(K, cipher, mi, M, 0, 1);
 	
-	// setting first octets
-	EM[0] = 0;
-	EM[1] = 2;
+	crt_garner(message, K, mi);
+}
+
+/**
+ * RSADP of count ciphertext representatives
+ * With the quintuple and AVX-512 IFMA, MB_LANES / u of them (RSA_BATCH
+ * for two primes) go through one multi-buffer run, their exponentiations
+ * mod each prime filling the lanes; otherwise (or for sizes above
+ * MB_MAX_BITS) they go one by one
+ *
+ * Error: "ciphertext representative out of range"
+ */
+int rsadp_batch(mpz_ptr *messages, struct rsa_priv *K, mpz_ptr *ciphers, int count) {
+	// vars
+	mpz_ptr base[MB_LANES], exp[MB_LANES], mod[MB_LANES];
+	mpz_t half[MB_LANES];
+	int i, j, k, nb, per, status;
 	
-	// concatenating PS
-	i=2;
-	count = 0;
-	for (i; i<(k-mLen-1); i++) {
-		EM[i] = PS[count];
-		count++;
+	// c must be between 0 and n - 1
+	for (i=0; i<count; i++) {
+		if (mpz_sgn(ciphers[i]) < 0 || mpz_cmp(ciphers[i], K->n) >= 0) {
+			rsa_error(RSA_EINVAL, "Cipher representative out of range");
+			return -1;
+		}
+	}
+	
+	if (!K->crt || !mb_available()) {
+		for (i=0; i<count; i++) {
+			if (-1 == rsadp(messages[i], K, ciphers[i])) {
+				return -1;
+			}
+		}
+		return 0;
 	}
 	
-	// setting 00 octets before M
-	EM[i] = 0;
+	for (j=0; j<MB_LANES; j++) {
+		mpz_init(half[j]);
+		base[j] = half[j];
+	}
 	
-	// concatenating M
-	i++;
-	count = 0;
-	for (i; i<k; i++) {
-		EM[i] = M[count];
-		count++;
+	per = MB_LANES / K->u;
+	for (i=0; i<count; i+=nb) {
+		nb = count - i < per ? count - i : per;
+		
+		// lanes u * j + k: m_(k+1) = c^d_(k+1) mod r_(k+1) of ciphertext j
+		for (j=0; j<nb; j++) {
+			for (k=0; k<K->u; k++) {
+				mpz_mod(half[K->u*j + k], ciphers[i+j], crt_prime(K, k));
+				exp[K->u*j + k] = crt_exp(K, k);
+				mod[K->u*j + k] = crt_prime(K, k);
+			}
+		}
+		status = mb_powm(base, base, exp, mod, K->u * nb);
+		
+		for (j=0; j<nb; j++) {
+			if (-1 == status) {
+				rsadp_crt(messages[i+j], K, ciphers[i+j], half, NULL);
+				continue;
+			}
+			
+			crt_garner(messages[i+j], K, half + K->u*j);
+		}
+	}
+	
+	for (j=0; j<MB_LANES; j++) {
+		mpz_clear(half[j]);
+	}
+	return 0;
+}
+
+/**
+ * Initialize the parts of a context shared by public and private keys
+ * 
+ * return -1 if an error occured
+ */
+static int rsa_ctx_init(struct rsa_ctx *ctx, mpz_t n) {
+	mp_bitcnt_t bits;
+	int i;
+	
+	ctx->k = rsa_octets(n);
+	bits   = mpz_sizeinbase(n, 2);
+	
+	// n - 1, for the range checks
+	mpz_init(ctx->n1);
+	mpz_sub_ui(ctx->n1, n, 1);
+	
+	// representatives and CRT scratch, allocated once to their full size
+	mpz_init2(ctx->m, 2*bits);
+	mpz_init2(ctx->c, 2*bits);
+	for (i=0; i<RSA_MAX_PRIMES; i++) {
+		mpz_init2(ctx->t[i], bits);
+	}
+	for (i=0; i<RSA_BATCH; i++) {
+		mpz_init2(ctx->bm[i], 2*bits);
+		mpz_init2(ctx->bc[i], bits);
+	}
+	
+	// no kernel until rsa_ctx_init_pub or rsa_ctx_init_priv
+	for (i=0; i<RSA_MAX_PRIMES; i++) {
+		ctx->mont[i].n = 0;
+	}
+	ctx->e_ui = 0;
+	ctx->split = NULL;
+	
+	ctx->EM  = malloc(ctx->k);
+	ctx->out = malloc(ctx->k);
+	if (NULL == ctx->EM || NULL == ctx->out) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		rsa_ctx_clear(ctx);
+		return -1;
+	}
+	
+	return 0;
+}
+
+/**
+ * Build a context for encryption with the public key (n, e)
+ * n and e are not copied and must outlive the context
+ * 
+ * return -1 if an error occured
+ */
+int rsa_ctx_init_pub(struct rsa_ctx *ctx, mpz_t n, mpz_t e) {
+	ctx->n = n;
+	ctx->e = e;
+	ctx->K = NULL;
+	
+	if (-1 == rsa_ctx_init(ctx, n)) {
+		return -1;
+	}
+	
+	// small public exponents take a square and multiply chain
+	ctx->e_ui = mpz_fits_ulong_p(e) ? mpz_get_ui(e) : 0;
+	mont_init(&ctx->mont[0], n);
+	
+	return 0;
+}
+
+/**
+ * Build a context for decryption with the private key K
+ * K is not copied and must outlive the context
+ * 
+ * return -1 if an error occured
+ */
+int rsa_ctx_init_priv(struct rsa_ctx *ctx, struct rsa_priv *K) {
+	int i;
+	
+	ctx->n = K->n;
+	ctx->e = NULL;
+	ctx->K = K;
+	
+	if (-1 == rsa_ctx_init(ctx, K->n)) {
+		return -1;
+	}
+	
+	// constants of the fixed-size kernels, when they fit the key
+	if (K->crt) {
+		for (i=0; i<K->u; i++) {
+			mont_init(&ctx->mont[i], crt_prime(K, i));
+		}
+	} else {
+		mont_init(&ctx->mont[0], K->n);
+	}
+	
+	return 0;
+}
+
+/**
+ * Clear a context built by rsa_ctx_init_pub or rsa_ctx_init_priv
+ */
+void rsa_ctx_clear(struct rsa_ctx *ctx) {
+	int i;
+	
+	mpz_clears(ctx->n1, ctx->m, ctx->c, NULL);
+	for (i=0; i<RSA_BATCH; i++) {
+		mpz_clears(ctx->bm[i], ctx->bc[i], NULL);
+	}
+	for (i=0; i<RSA_MAX_PRIMES; i++) {
+		mpz_clear(ctx->t[i]);
+		mont_clear(&ctx->mont[i]);
+	}
+	if (NULL != ctx->split) {
+		split_destroy(ctx->split);
+		ctx->split = NULL;
+	}
+	free(ctx->EM);
+	free(ctx->out);
+	ctx->EM  = NULL;
+	ctx->out = NULL;
+}
+
+/**
+ * Low-latency mode of a private context: with on != 0, the halves mod p
+ * and mod q of each RSADP run at the same time, the one mod q on a
+ * helper thread pinned to another CPU (multi-prime keys: every other
+ * prime on the helper). The mode stays off for keys
+ * without the quintuple and processes limited to one CPU, and each
+ * RSADP falls back to one thread while running pools and other helpers
+ * leave no CPU free.
+ *
+ * return -1 if the helper could not be created
+ */
+int rsa_ctx_split(struct rsa_ctx *ctx, int on) {
+	if (!on || NULL == ctx->K || !ctx->K->crt || !split_available()) {
+		if (NULL != ctx->split) {
+			split_destroy(ctx->split);
+			ctx->split = NULL;
+		}
+		return 0;
+	}
+	
+	if (NULL == ctx->split) {
+		ctx->split = split_create();
+		if (NULL == ctx->split) {
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/**
+ * RSAEP with a public context: c = m^e mod n
+ *
+ * Error: "message representative out of range"
+ */
+int rsa_ctx_rsaep(struct rsa_ctx *ctx, mpz_t cipher, mpz_t message) {
+	// m must be between 0 and n - 1
+	if (mpz_sgn(message) < 0 || mpz_cmp(message, ctx->n1) > 0) {
+		rsa_error(RSA_EINVAL, "Message representative out of range");
+		return -1;
+	}
+	
+	STATS_BEGIN(t);
+	if (0 == ctx->e_ui || -1 == mont_powm_ui(cipher, message, ctx->e_ui, &ctx->mont[0])) {
+		mpz_powm(cipher, message, ctx->e, ctx->n);
+	}
+	STATS_END(STAGE_POWM, t);
+	return 0;
+}
+
+/**
+ * CRT exponentiations run by the helper of a context: every other prime,
+ * from q
+ */
+struct crt_half {
+	struct rsa_priv *K;
+	mpz_ptr cipher;
+	mpz_t *mi;
+	struct rsa_mont *M;
+};
+
+static void crt_half(void *arg) {
+	struct crt_half *half = arg;
+	
+	crt_powers(half->K, half->cipher, half->mi, half->M, 1, 2);
+}
+
+/**
+ * RSADP with a private context: m = c^d mod n, through the CRT when
+ * the quintuple is known (both halves at once in low-latency mode)
+ *
+ * Error: "ciphertext representative out of range"
+ */
+int rsa_ctx_rsadp(struct rsa_ctx *ctx, mpz_t message, mpz_t cipher) {
+	// vars
+	struct crt_half half;
+	
+	// c must be between 0 and n - 1
+	if (mpz_sgn(cipher) < 0 || mpz_cmp(cipher, ctx->n1) > 0) {
+		rsa_error(RSA_EINVAL, "Cipher representative out of range");
+		return -1;
+	}
+	
+	STATS_BEGIN(t);
+	if (!ctx->K->crt) {
+		rsa_powm(message, cipher, ctx->K->d, ctx->n, &ctx->mont[0]);
+	} else if (NULL != ctx->split && split_claim(ctx->split)) {
+		// m_2 = c^dQ mod q (and m_4) on the helper, m_1 = c^dP mod p
+		// (and m_3) here
+		half.K 		= ctx->K;
+		half.cipher = cipher;
+		half.mi 	= ctx->t;
+		half.M 		= ctx->mont;
+		split_start(ctx->split, crt_half, &half);
+		crt_powers(ctx->K, cipher, ctx->t, ctx->mont, 0, 2);
+		split_wait(ctx->split);
+		crt_garner(message, ctx->K, ctx->t);
+	} else {
+		rsadp_crt(message, ctx->K, cipher, ctx->t, ctx->mont);
 	}
-	free(PS);
+	STATS_END(STAGE_POWM, t);
+	
+	return 0;
+}
+
+/**
+ * RSAES-PKCS1-V1_5-ENCRYPT with a public context
+ * 
+ * Input:
+ *  M        message to be encrypted, an octet string of length mLen,
+ *           where mLen <= k - 11
+ *
+ * Output:
+ *  C        ciphertext, an octet string of length k, written into the
+ *           caller's buffer of cSize octets (C may be M)
+ *
+ * return k, -1 on error ("message too long", buffer too small)
+ */
+int rsa_ctx_encrypt_into(struct rsa_ctx *ctx, unsigned char *C, int cSize, unsigned char *M, int mLen) {
+	// vars
+	unsigned char *EM = ctx->EM;
+	int k = ctx->k;
+	
+	// length checking 
+	if (mLen > (k-11)) {
+		rsa_error(RSA_EINVAL, "Message too large");
+		return -1;
+	}
+	if (cSize < k) {
+		rsa_error(RSA_EINVAL, "Output buffer too small (%d octets, %d needed)", cSize, k);
+		return -1;
+	}
+	
+	// Concatenate PS, the message M, and other padding to form an
+	// encoded message EM of length k octets as
+	// EM = 00 | 02 | PS | 00 | M
+	// where PS consists of k - mLen - 3 pseudo-randomly generated
+	// nonzero octets (at least eight), from the thread's generator
+	EM[0] = 0;
+	EM[1] = 2;
+	STATS_BEGIN(t_pad);
+	if (rand_nonzero_bytes(EM + 2, k - mLen - 3) == -1) {
+		return -1;
+	}
+	STATS_END(STAGE_PADDING, t_pad);
+	EM[k - mLen - 1] = 0;
+	memmove(EM + k - mLen, M, mLen);
 	
 	// Convert the encoded message EM to an integer message
-    // representative m
-    mpz_init(m);
-    os2ip(m, EM, k);
-    free(EM);
-    
-    // Apply the RSAEP encryption primitive to the RSA
-    // public key (n, e) and the message representative m to produce
-    // an integer ciphertext representative c
-    mpz_init(c);
-    if (-1 == rsaep(c, n, e, m)) {
-		mpz_clear(c);
-		mpz_clear(m);
+	// representative m, apply RSAEP and convert the ciphertext
+	// representative c to a ciphertext C of length k octets
+	STATS_BEGIN(t_os2ip);
+	os2ip(ctx->m, EM, k);
+	STATS_END(STAGE_OS2IP, t_os2ip);
+	if (-1 == rsa_ctx_rsaep(ctx, ctx->c, ctx->m)) {
+		return -1;
+	}
+	
+	STATS_BEGIN(t_i2osp);
+	if (-1 == i2osp(C, ctx->c, k)) {
+		return -1;
+	}
+	STATS_END(STAGE_I2OSP, t_i2osp);
+	
+	return k;
+}
+
+/**
+ * rsa_ctx_encrypt_into, the ciphertext being held by the context
+ * until its next operation
+ */
+unsigned char * rsa_ctx_encrypt(struct rsa_ctx *ctx, unsigned char *M, int mLen) {
+	if (-1 == rsa_ctx_encrypt_into(ctx, ctx->out, ctx->k, M, mLen)) {
 		return NULL;
 	}
 	
-	// clearing
-    mpz_clear(m);
-    
-    // Convert the ciphertext representative c to a ciphertext C of
-    // length k octets
-    C = i2osp(c, k);
-    if (NULL == C) {
-		mpz_clear(c);
+	return ctx->out;
+}
+
+/**
+ * Convert the message representative m to an encoded message EM of
+ * length k octets, then decode it
+ *
+ * return M within EM, NULL on "decryption error"
+ */
+static unsigned char * ctx_decode(struct rsa_ctx *ctx, unsigned char *EM, mpz_t m, int *mLen) {
+	int i, k = ctx->k;
+	
+	STATS_BEGIN(t_i2osp);
+	if (-1 == i2osp(EM, m, k)) {
 		return NULL;
 	}
+	STATS_END(STAGE_I2OSP, t_i2osp);
 	
-	// clearing
-    mpz_clear(c);
+	// EME-PKCS1-v1_5 decoding: Separate the encoded message EM into an
+	// octet string PS consisting of nonzero octets and a message M as
+	// EM = 0x00 || 0x02 || PS || 0x00 || M.
+	// PS must be at least eight octets long
+	STATS_BEGIN(t_unpad);
+	for (i=2; i<k && EM[i] != 0; i++);
+	STATS_END(STAGE_UNPAD, t_unpad);
+	if (EM[0] != 0 || EM[1] != 2 || i == k || i < 10) {
+		rsa_error(RSA_EDECRYPT, "Decryption error.");
+		return NULL;
+	}
 	
-	return C;
+	*mLen = k - i - 1;
+	return EM + i + 1;
 }
 
 /**
- * RSAES-PKCS1-V1_5-DECRYPT (K, C)
+ * RSAES-PKCS1-V1_5-DECRYPT with a private context
  * 
  * Input:
- *  K        recipient's RSA private key
- *  C        ciphertext to be decrypted, an octet string of length k,
- *           where k is the length in octets of the RSA modulus n
+ *  C        ciphertext to be decrypted, an octet string of length k
  *
  * Output:
- *  M        message, an octet string of length at most k - 11
+ *  M        message, an octet string of length at most k - 11, held
+ *           by the context until its next operation
+ *  mLen     length of M
  *
  * Error: "decryption error"
  */
-unsigned char * rsads_pkcs1_decrypt(mpz_t n, mpz_t d, int cLen, unsigned char *C) {
+unsigned char * rsa_ctx_decrypt(struct rsa_ctx *ctx, unsigned char *C, int cLen, int *mLen) {
 	// vars
-	int k, i, error, count;
-	mpz_t c, m;
-	unsigned char *EM, *M;
-	FILE *fp_rsa;
-	
-	// retrieving modulus length
-	k = mpz_size(n) * GMP_LIMB_BITS / 8;
+	unsigned char *EM = ctx->out;
+	int k = ctx->k;
 	
 	// Length checking: If the length of the ciphertext C is not k octets
-    // (or if k < 11), output "decryption error" and stop.
-    if (cLen < 11 || cLen != k) {
-		printf("Decryption error.\n");
+	// (or if k < 11), output "decryption error" and stop.
+	if (cLen < 11 || cLen != k) {
+		rsa_error(RSA_EDECRYPT, "Decryption error.");
 		return NULL;
 	}
 	
-	// Convert the ciphertext C to an integer ciphertext
-    // representative c
-    mpz_init(c);
-    os2ip(c, C, k);
-    
-    // Apply the RSADP decryption primitive to the RSA
-    // private key (n, d) and the ciphertext representative c to
-    // produce an integer message representative m
-	mpz_init(m);
-	if (-1 == rsadp(m, n, d, c)) {
+	// Convert the ciphertext C to an integer ciphertext representative
+	// c, apply RSADP and convert the message representative m to an
+	// encoded message EM of length k octets
+	STATS_BEGIN(t_os2ip);
+	os2ip(ctx->c, C, k);
+	STATS_END(STAGE_OS2IP, t_os2ip);
+	if (-1 == rsa_ctx_rsadp(ctx, ctx->m, ctx->c)) {
 		return NULL;
 	}
-	mpz_clear(c);
 	
-	// Convert the message representative m to an encoded message EM
-    // of length k octets
-    EM = i2osp(m, k);
-    mpz_clear(m);
-    if (NULL == EM) {
-		mpz_clear(d);
-		mpz_clear(n);
-		free(EM);
-		return NULL;
+	return ctx_decode(ctx, EM, ctx->m, mLen);
+}
+
+/**
+ * rsa_ctx_decrypt, the message being written into the caller's buffer
+ * of mSize octets (M may be C)
+ *
+ * return the length of M, -1 on error ("decryption error", buffer
+ * too small)
+ */
+int rsa_ctx_decrypt_into(struct rsa_ctx *ctx, unsigned char *M, int mSize, unsigned char *C, int cLen) {
+	// vars
+	unsigned char *EM;
+	int mLen;
+	
+	EM = rsa_ctx_decrypt(ctx, C, cLen, &mLen);
+	if (NULL == EM) {
+		return -1;
 	}
 	
-	// EME-PKCS1-v1_5 decoding: Separate the encoded message EM into an
-    // octet string PS consisting of nonzero octets and a message M as
-    // EM = 0x00 || 0x02 || PS || 0x00 || M.
-    
-    // Checking bit 1 and 2
-    if (EM[0] != 0 && EM[1] != 2) {
-		printf("Decryption error.\n");
-		free(EM);
-		return NULL;
+	if (mLen > mSize) {
+		rsa_error(RSA_EINVAL, "Output buffer too small (%d octets, %d needed)", mSize, mLen);
+		return -1;
 	}
 	
-	i=2;
-	error = 1;
-	count = 0;
-	for (i;i<k;i++) {
-		// octet 0 ?
-		if (EM[i] == 0 && error == 1) {
-			// ok to continue
-			error = 0;
-			
-			// size of the message: k - i
-			M = (char *) malloc((k - i) * sizeof(char *));
-			if (NULL == M) {
-				printf("Memory error\n");
-				exit(1);
-			}
-			
-			memset(M, '\0', k-i);
-			continue;
+	memcpy(M, EM, mLen);
+	return mLen;
+}
+
+/**
+ * rsa_ctx_decrypt_into of count <= RSA_BATCH ciphertexts of k octets,
+ * one after the other in C, through rsadp_batch. The message i is
+ * written at M + i * mSize, its length in mLen[i] (-1 if it failed).
+ *
+ * return -1 if a message failed
+ */
+int rsa_ctx_decrypt_batch_into(struct rsa_ctx *ctx, unsigned char *M, int mSize, int *mLen,
+							   unsigned char *C, int count) {
+	// vars
+	mpz_ptr c[RSA_BATCH], m[RSA_BATCH];
+	unsigned char *out;
+	int i, k = ctx->k, batch, status;
+	
+	if (count < 1 || count > RSA_BATCH) {
+		rsa_error(RSA_EINVAL, "Batch of %d ciphertexts (1 to %d).", count, RSA_BATCH);
+		return -1;
+	}
+	
+	STATS_BEGIN(t_os2ip);
+	for (i=0; i<count; i++) {
+		os2ip(ctx->bc[i], C + (size_t) i * k, k);
+		c[i] = ctx->bc[i];
+		m[i] = ctx->bm[i];
+	}
+	STATS_END(STAGE_OS2IP, t_os2ip);
+	
+	STATS_BEGIN(t);
+	batch = rsadp_batch(m, ctx->K, c, count);
+	STATS_END(STAGE_POWM, t);
+	
+	// a representative out of range fails the whole run: one by one then
+	status = 0;
+	for (i=0; i<count; i++) {
+		if (-1 == batch) {
+			out = rsa_ctx_decrypt(ctx, C + (size_t) i * k, k, &mLen[i]);
+		} else {
+			out = ctx_decode(ctx, ctx->out, ctx->bm[i], &mLen[i]);
 		}
 		
-		// no error, filling the message representative
-		if (0 == error) {
-			M[count++] = (char) EM[i];
+		if (NULL == out) {
+			mLen[i] = -1;
+			status  = -1;
+		} else if (mLen[i] > mSize) {
+			rsa_error(RSA_EINVAL, "Output buffer too small (%d octets, %d needed)", mSize, mLen[i]);
+			mLen[i] = -1;
+			status  = -1;
+		} else {
+			memcpy(M + (size_t) i * mSize, out, mLen[i]);
 		}
 	}
-	free(EM);
 	
-	if (1 == error) {
-		printf("Decryption error.\n");
+	return status;
+}
+
+/**
+ * Input:
+ *  (n, e)   recipient's RSA public key (k denotes the length in octets
+ *           of the modulus n)
+ *  M        message to be encrypted, an octet string of length mLen,
+ *           where mLen <= k - 11
+ *
+ * Output:
+ *  C        ciphertext, an octet string of length k
+ *
+ * Error: "message too long"
+ */
+unsigned char * rsaes_pkcs1_encrypt(mpz_t n, mpz_t e, unsigned char *M, int mLen) {
+	// vars
+	struct rsa_ctx ctx;
+	unsigned char *C, *out;
+	
+	// one-shot context
+	if (-1 == rsa_ctx_init_pub(&ctx, n, e)) {
 		return NULL;
 	}
 	
+	C   = NULL;
+	out = rsa_ctx_encrypt(&ctx, M, mLen);
+	if (NULL != out) {
+		C = malloc(ctx.k);
+		if (NULL == C) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+		} else {
+			memcpy(C, out, ctx.k);
+		}
+	}
+	
+	rsa_ctx_clear(&ctx);
+	return C;
+}
+
+/**
+ * rsaes_pkcs1_encrypt into the caller's buffer C of cSize octets
+ * The context is built for this call only: to encrypt many blocks
+ * without allocating, use rsa_ctx_encrypt_into
+ *
+ * return k, -1 if an error occured
+ */
+int rsaes_pkcs1_encrypt_into(mpz_t n, mpz_t e, unsigned char *C, int cSize, unsigned char *M, int mLen) {
+	// vars
+	struct rsa_ctx ctx;
+	int cLen;
+	
+	if (-1 == rsa_ctx_init_pub(&ctx, n, e)) {
+		return -1;
+	}
+	
+	cLen = rsa_ctx_encrypt_into(&ctx, C, cSize, M, mLen);
+	rsa_ctx_clear(&ctx);
+	return cLen;
+}
+
+/**
+ * RSAES-PKCS1-V1_5-DECRYPT (K, C)
+ * 
+ * Input:
+ *  K        recipient's RSA private key
+ *  C        ciphertext to be decrypted, an octet string of length k,
+ *           where k is the length in octets of the RSA modulus n
+ *
+ * Output:
+ *  M        message, an octet string of length at most k - 11
+ *  mLen     length of M
+ *
+ * Error: "decryption error"
+ */
+unsigned char * rsads_pkcs1_decrypt(struct rsa_priv *K, int cLen, unsigned char *C, int *mLen) {
+	// vars
+	struct rsa_ctx ctx;
+	unsigned char *M, *out;
+	
+	// one-shot context
+	if (-1 == rsa_ctx_init_priv(&ctx, K)) {
+		return NULL;
+	}
+	
+	M   = NULL;
+	out = rsa_ctx_decrypt(&ctx, C, cLen, mLen);
+	if (NULL != out) {
+		// at least one octet, for empty messages
+		M = malloc(*mLen + 1);
+		if (NULL == M) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+		} else {
+			memcpy(M, out, *mLen);
+		}
+	}
+	
+	rsa_ctx_clear(&ctx);
 	return M;
 }
+
+/**
+ * rsads_pkcs1_decrypt into the caller's buffer M of mSize octets
+ * The context is built for this call only: to decrypt many blocks
+ * without allocating, use rsa_ctx_decrypt_into
+ *
+ * return the length of M, -1 if an error occured
+ */
+int rsads_pkcs1_decrypt_into(struct rsa_priv *K, unsigned char *M, int mSize, unsigned char *C, int cLen) {
+	// vars
+	struct rsa_ctx ctx;
+	int mLen;
+	
+	if (-1 == rsa_ctx_init_priv(&ctx, K)) {
+		return -1;
+	}
+	
+	mLen = rsa_ctx_decrypt_into(&ctx, M, mSize, C, cLen);
+	rsa_ctx_clear(&ctx);
+	return mLen;
+}
@@ -8,16 +8,110 @@
 
 #include <gmp.h>
 
-void generate_prime(mpz_t prime, int length);
-void generate_keypair(mpz_t n, mpz_t e, mpz_t d);
+#include "rsa_error.h"
+#include "rsa_mont.h"
+#include "rsa_split.h"
 
-unsigned char * i2osp(mpz_t x, int xLen);
-void os2ip(mpz_t x, unsigned char * X);
+// modulus sizes accepted for key generation, in bits
+#define RSA_DEFAULT_BITS 	2048
+#define RSA_MIN_BITS 		512
+#define RSA_MAX_BITS 		16384
 
-unsigned char * rsaes_pkcs1_encrypt(mpz_t n, mpz_t e, unsigned char * M);
-unsigned char * rsads_pkcs1_decrypt(mpz_t n, mpz_t d, int cLen, unsigned char *C);
+// primes of a multi-prime key (PKCS#1 u), and the smallest of them
+#define RSA_MAX_PRIMES 		4
+#define RSA_MIN_PRIME_BITS 	256
+
+// ciphertexts per multi-buffer RSADP run (their CRT halves fill 8 lanes)
+#define RSA_BATCH 			4
+
+/**
+ * RSA private key (PKCS#1 section 3.2)
+ *
+ * Both representations are kept: the pair (n, d) and the quintuple
+ * (p, q, dP, dQ, qInv) used by the CRT path of rsadp. crt is 0 when
+ * only the pair is known (keys saved by older versions).
+ *
+ * A multi-prime key (u = 3 or 4 primes) follows the quintuple with the
+ * triplets (r_i, d_i, t_i), i = 3, ..., u, at index i - 3 of r, di
+ * and ti.
+ *
+ * A key loaded from a binary key file points into the mapping of the
+ * file (map, map_len): its integers are read-only.
+ */
+struct rsa_priv {
+	mpz_t n, d;
+	mpz_t p, q;
+	mpz_t dP, dQ, qInv;
+	mpz_t r[RSA_MAX_PRIMES-2], di[RSA_MAX_PRIMES-2], ti[RSA_MAX_PRIMES-2];
+	int crt;
+	int u; 					// number of primes, 2 unless multi-prime
+	void *map;
+	size_t map_len;
+};
+
+void rsa_priv_init(struct rsa_priv *K);
+void rsa_priv_clear(struct rsa_priv *K);
+int rsa_priv_derive(struct rsa_priv *K, mpz_t e);
+
+/**
+ * Per-key state reused by every operation: k, n - 1, the integer
+ * representatives (allocated once to the size of n), the Montgomery
+ * constants of the private key and the EM and output buffers. A
+ * context is not shared between threads (its helper of the low-latency
+ * mode is its own).
+ */
+struct rsa_ctx {
+	int k; 					// length in octets of n
+	mpz_ptr n, e; 			// public key, not owned
+	struct rsa_priv *K; 	// private key, not owned (NULL if public)
+	mpz_t n1; 				// n - 1
+	mpz_t m, c; 			// representatives
+	mpz_t t[RSA_MAX_PRIMES]; // CRT scratch, c^d_i mod r_i
+	mpz_t bm[RSA_BATCH]; 	// representatives of rsa_ctx_decrypt_batch_into
+	mpz_t bc[RSA_BATCH];
+	struct rsa_mont mont[RSA_MAX_PRIMES]; // r_1 (p) to r_u, or n alone (public key, or no quintuple)
+	unsigned long e_ui; 	// e if it fits in a word, 0 otherwise
+	struct rsa_split *split; // helper of the low-latency mode, NULL when off
+	unsigned char *EM; 		// encoded message, k octets
+	unsigned char *out; 	// result of the last operation, k octets
+};
+
+int rsa_ctx_init_pub(struct rsa_ctx *ctx, mpz_t n, mpz_t e);
+int rsa_ctx_init_priv(struct rsa_ctx *ctx, struct rsa_priv *K);
+void rsa_ctx_clear(struct rsa_ctx *ctx);
+int rsa_ctx_split(struct rsa_ctx *ctx, int on);
+
+int rsa_ctx_rsaep(struct rsa_ctx *ctx, mpz_t cipher, mpz_t message);
+int rsa_ctx_rsadp(struct rsa_ctx *ctx, mpz_t message, mpz_t cipher);
+unsigned char * rsa_ctx_encrypt(struct rsa_ctx *ctx, unsigned char *M, int mLen);
+unsigned char * rsa_ctx_decrypt(struct rsa_ctx *ctx, unsigned char *C, int cLen, int *mLen);
+
+// into caller-owned buffers: no allocation per block
+int rsa_ctx_encrypt_into(struct rsa_ctx *ctx, unsigned char *C, int cSize, unsigned char *M, int mLen);
+int rsa_ctx_decrypt_into(struct rsa_ctx *ctx, unsigned char *M, int mSize, unsigned char *C, int cLen);
+int rsa_ctx_decrypt_batch_into(struct rsa_ctx *ctx, unsigned char *M, int mSize, int *mLen,
+							   unsigned char *C, int count);
+
+int miller_rabin_rounds(int bits);
+int miller_rabin(mpz_t n, int rounds, gmp_randstate_t rs);
+int search_prime(mpz_t prime, int length, gmp_randstate_t rs, int *cancel);
+int generate_prime(mpz_t prime, int length);
+int generate_primes_mt(mpz_t p, mpz_t q, int length, int nb_threads);
+int generate_keypair(mpz_t e, struct rsa_priv *K, int bits, int nb_threads);
+int generate_keypair_multi(mpz_t e, struct rsa_priv *K, int bits, int nb_primes, int nb_threads);
+
+int rsa_octets(mpz_t n);
+int i2osp(unsigned char *X, mpz_t x, int xLen);
+void os2ip(mpz_t x, unsigned char * X, size_t xLen);
+
+unsigned char * rsaes_pkcs1_encrypt(mpz_t n, mpz_t e, unsigned char * M, int mLen);
+unsigned char * rsads_pkcs1_decrypt(struct rsa_priv *K, int cLen, unsigned char *C, int *mLen);
+int rsaes_pkcs1_encrypt_into(mpz_t n, mpz_t e, unsigned char *C, int cSize, unsigned char *M, int mLen);
+int rsads_pkcs1_decrypt_into(struct rsa_priv *K, unsigned char *M, int mSize, unsigned char *C, int cLen);
 
 int rsaep(mpz_t cipher, mpz_t n, mpz_t e, mpz_t message);
-int rsadp(mpz_t message, mpz_t n, mpz_t d, mpz_t cipher);
+int rsadp(mpz_t message, struct rsa_priv *K, mpz_t cipher);
+void rsadp_crt(mpz_t message, struct rsa_priv *K, mpz_t cipher, mpz_t *mi, struct rsa_mont *M);
+int rsadp_batch(mpz_ptr *messages, struct rsa_priv *K, mpz_ptr *ciphers, int count);
 
 #endif // _H_RSA_
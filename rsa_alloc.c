@@ -0,0 +1,314 @@
+/*
+ * File: rsa_alloc.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <gmp.h>
+
+#include "rsa_error.h"
+#include "rsa_alloc.h"
+
+// class of the blocks that do not fit in an arena
+#define ARENA_LARGE 	ARENA_CLASSES 		// from malloc
+#define ARENA_MAPPED 	(ARENA_CLASSES + 1) // own mapping (secure)
+
+#define ARENA_MAX_BLOCK ((size_t) ARENA_MIN_BLOCK << (ARENA_CLASSES - 1))
+
+/**
+ * In front of every block, 16 octets so that the blocks keep the
+ * alignment of malloc
+ */
+struct arena_header {
+	uint32_t class;
+	uint32_t reserved;
+	uint64_t size; 			// usable octets of a large block
+};
+
+// a free block holds the link to the next one of its class
+struct arena_free {
+	struct arena_free *next;
+};
+
+/**
+ * Unused end of a chunk, [rest, end): of a thread that left, or too
+ * small for the block its thread needed, carved by the next thread
+ * running out of room
+ */
+struct arena_rest {
+	struct arena_rest *next;
+	unsigned char *end;
+};
+
+/**
+ * Blocks of a thread: a free list per size class (powers of 2), then
+ * the rest of its current chunk, carved on demand
+ */
+struct arena {
+	struct arena_free *free[ARENA_CLASSES];
+	unsigned char *bump, *end;
+	int registered;
+};
+
+static __thread struct arena arena;
+
+// free blocks of the threads that left, taken back by the others
+static struct arena_free *depot[ARENA_CLASSES];
+static struct arena_rest *rests;
+static pthread_mutex_t depot_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t arena_key;
+static int arena_flags;
+static int installed;
+
+static inline struct arena_header * arena_header(void *ptr) {
+	return (struct arena_header *) ptr - 1;
+}
+
+static inline int arena_class(size_t size) {
+	if (size <= ARENA_MIN_BLOCK) {
+		return 0;
+	}
+
+	return 64 - __builtin_clzl((size - 1) / ARENA_MIN_BLOCK);
+}
+
+/**
+ * Move the unused end of the chunk of a thread to the rests, if it holds
+ * a block (depot_lock held)
+ */
+static void arena_keep_rest(struct arena *a) {
+	struct arena_rest *rest;
+
+	if (NULL != a->bump && (size_t) (a->end - a->bump) >= sizeof(struct arena_header) + ARENA_MIN_BLOCK) {
+		rest 	   = (struct arena_rest *) a->bump;
+		rest->end  = a->end;
+		rest->next = rests;
+		rests 	   = rest;
+	}
+	a->bump = a->end = NULL;
+}
+
+/**
+ * Hand the free blocks and the rest of the chunk of a leaving thread to
+ * the depot: in secure mode, these pages stay locked
+ */
+static void arena_release(void *data) {
+	struct arena *a = data;
+	struct arena_free *last;
+	int c;
+
+	pthread_mutex_lock(&depot_lock);
+	arena_keep_rest(a);
+
+	for (c=0; c<ARENA_CLASSES; c++) {
+		if (NULL == a->free[c]) {
+			continue;
+		}
+
+		for (last=a->free[c]; NULL != last->next; last=last->next);
+		last->next = depot[c];
+		depot[c]   = a->free[c];
+		a->free[c] = NULL;
+	}
+	pthread_mutex_unlock(&depot_lock);
+}
+
+/**
+ * Map len octets, locked in memory and left out of core dumps in secure
+ * mode (best effort: beyond RLIMIT_MEMLOCK, the pages are not locked)
+ */
+static void * arena_map(size_t len) {
+	void *pages;
+
+	pages = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == pages) {
+		return NULL;
+	}
+
+	if (arena_flags & RSA_ALLOC_SECURE) {
+		mlock(pages, len);
+		madvise(pages, len, MADV_DONTDUMP);
+	}
+
+	return pages;
+}
+
+/**
+ * A block too large for the arenas
+ * Like the default functions of GMP, aborts when memory is missing
+ */
+static void * arena_alloc_large(size_t size) {
+	struct arena_header *h;
+
+	if (arena_flags & RSA_ALLOC_SECURE) {
+		h = arena_map(sizeof(*h) + size);
+		if (NULL != h) {
+			h->class = ARENA_MAPPED;
+		}
+	} else {
+		h = malloc(sizeof(*h) + size);
+		if (NULL != h) {
+			h->class = ARENA_LARGE;
+		}
+	}
+
+	if (NULL == h) {
+		abort();
+	}
+
+	h->size = size;
+	return h + 1;
+}
+
+/**
+ * A new block of class c: from the depot, else from the current chunk,
+ * else from the rest of a chunk left by another thread, else from a new
+ * chunk
+ */
+static void * arena_carve(struct arena *a, int c) {
+	struct arena_header *h;
+	struct arena_rest **rest, *found;
+	size_t len = sizeof(*h) + (ARENA_MIN_BLOCK << c);
+	int fits = NULL != a->bump && a->bump + len <= a->end;
+
+	found = NULL;
+	pthread_mutex_lock(&depot_lock);
+	if (NULL != depot[c]) {
+		a->free[c] = depot[c]->next;
+		h = arena_header(depot[c]);
+		depot[c] = NULL;
+		pthread_mutex_unlock(&depot_lock);
+		return h + 1;
+	}
+
+	// too small for this block, the end of the chunk may hold others
+	if (!fits) {
+		arena_keep_rest(a);
+	}
+	for (rest=&rests; !fits && NULL != *rest; rest=&(*rest)->next) {
+		if ((size_t) ((*rest)->end - (unsigned char *) *rest) >= len) {
+			found = *rest;
+			*rest = found->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&depot_lock);
+
+	if (NULL != found) {
+		a->bump = (unsigned char *) found;
+		a->end 	= found->end;
+	} else if (!fits) {
+		a->bump = arena_map(ARENA_CHUNK);
+		if (NULL == a->bump) {
+			return arena_alloc_large(ARENA_MIN_BLOCK << c);
+		}
+		a->end = a->bump + ARENA_CHUNK;
+	}
+
+	h = (struct arena_header *) a->bump;
+	h->class = c;
+	a->bump += len;
+	return h + 1;
+}
+
+/**
+ * Make sure the depot gets the blocks of the thread back when it leaves
+ */
+static inline void arena_register(struct arena *a) {
+	if (!a->registered) {
+		pthread_setspecific(arena_key, a);
+		a->registered = 1;
+	}
+}
+
+static void * arena_alloc(size_t size) {
+	struct arena *a = &arena;
+	struct arena_free *block;
+	int c;
+
+	if (size > ARENA_MAX_BLOCK) {
+		return arena_alloc_large(size);
+	}
+
+	arena_register(a);
+	c = arena_class(size);
+	block = a->free[c];
+	if (NULL == block) {
+		return arena_carve(a, c);
+	}
+
+	a->free[c] = block->next;
+	return block;
+}
+
+static void arena_free(void *ptr, size_t size) {
+	struct arena_header *h = arena_header(ptr);
+	struct arena_free *block = ptr;
+	struct arena *a = &arena;
+
+	if (arena_flags & RSA_ALLOC_SECURE) {
+		memset(ptr, 0, h->class < ARENA_CLASSES ? size : h->size);
+	}
+
+	if (ARENA_LARGE == h->class) {
+		free(h);
+	} else if (ARENA_MAPPED == h->class) {
+		munmap(h, sizeof(*h) + h->size);
+	} else {
+		// kept by the freeing thread, whichever thread allocated it
+		arena_register(a);
+		block->next 	  = a->free[h->class];
+		a->free[h->class] = block;
+	}
+}
+
+static void * arena_realloc(void *ptr, size_t old_size, size_t new_size) {
+	struct arena_header *h = arena_header(ptr);
+	void *block;
+
+	// still fits in its class
+	if (h->class < ARENA_CLASSES && new_size <= (ARENA_MIN_BLOCK << h->class)) {
+		if ((arena_flags & RSA_ALLOC_SECURE) && new_size < old_size) {
+			memset((unsigned char *) ptr + new_size, 0, old_size - new_size);
+		}
+		return ptr;
+	}
+
+	block = arena_alloc(new_size);
+	memcpy(block, ptr, old_size < new_size ? old_size : new_size);
+	arena_free(ptr, old_size);
+	return block;
+}
+
+/**
+ * Route every allocation of GMP to per-thread arenas: blocks of the
+ * same size class are reused by the thread that freed them, without
+ * locking, and new ones are carved from ARENA_CHUNK mappings
+ * With RSA_ALLOC_SECURE, the pages are locked in memory and the blocks
+ * zeroed when freed, so that key material does not linger
+ *
+ * Must be called before any GMP integer is allocated: the blocks of the
+ * previous functions cannot be freed by the arenas
+ *
+ * return -1 if an error occured
+ */
+int rsa_alloc_install(int flags) {
+	if (installed) {
+		rsa_error(RSA_EINVAL, "The allocator is already installed.");
+		return -1;
+	}
+
+	if (pthread_key_create(&arena_key, arena_release) != 0) {
+		rsa_error(RSA_ETHREAD, "Unable to create the arena key.");
+		return -1;
+	}
+
+	arena_flags = flags;
+	installed 	= 1;
+	mp_set_memory_functions(arena_alloc, arena_realloc, arena_free);
+	return 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * File: rsa_alloc.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_ALLOC_
+#define _H_RSA_ALLOC_
+
+// flags of rsa_alloc_install
+#define RSA_ALLOC_SECURE 	1 	// mlock'd pages, blocks zeroed when freed
+
+// smallest and largest size class, larger blocks go to malloc
+#define ARENA_MIN_BLOCK 	16
+#define ARENA_CLASSES 		13 	// 16 octets to 64 KiB
+// pages mapped at once by a thread running out of blocks
+#define ARENA_CHUNK 		(1 << 20)
+
+int rsa_alloc_install(int flags);
+
+#endif // _H_RSA_ALLOC_
@@ -0,0 +1,462 @@
+/*
+ * File: rsa_bench.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_rand.h"
+#include "rsa_alloc.h"
+#include "rsa_mb.h"
+#include "rsa_mont.h"
+
+#define BENCH_MAX_SIZES 	8
+#define BENCH_MAX_ITERS 	100000
+#define BENCH_MIN_ITERS 	3
+// random values checked against GMP per size, with --verify
+#define BENCH_VERIFY 		64
+// ciphertexts of rsadp_batch: partial, full and several groups of lanes
+#define BENCH_VERIFY_BATCH 	(2 * MB_LANES + 1)
+
+/**
+ * Everything an operation needs for one modulus size
+ */
+struct bench_key {
+	int bits;
+	int primes; 			// of the key, 2 unless --primes
+	mpz_t e;
+	struct rsa_priv K;
+	struct rsa_ctx pub, priv;
+	struct rsa_ctx split; 	// priv in low-latency mode
+	mpz_t m, c, r; 			// representatives
+	unsigned char *M; 		// message, k - 11 octets
+	unsigned char *C; 		// ciphertext of M, k octets
+	unsigned char *X; 		// octet string scratch, k octets
+	unsigned char *CB; 		// RSA_BATCH copies of C
+	unsigned char *MB; 		// RSA_BATCH messages, k octets each
+};
+
+typedef void (*bench_op)(struct bench_key *key);
+
+/**
+ * Options and state of the whole run
+ */
+struct bench {
+	double budget; 			// seconds per operation
+	int json;
+	int first; 				// no result printed yet (json)
+	int verify; 			// check the kernels against GMP first
+	double *samples; 		// latencies, in microseconds
+};
+
+static double now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * Value below which p percent of the sorted samples fall
+ */
+static double percentile(double *sorted, int count, double p) {
+	int i = (int) (p / 100.0 * (count - 1) + 0.5);
+
+	return sorted[i];
+}
+
+/*
+ * Operations
+ */
+
+static void op_generate_prime(struct bench_key *key) {
+	generate_prime(key->r, key->bits / key->primes);
+}
+
+static void op_generate_keypair(struct bench_key *key) {
+	struct rsa_priv K;
+	mpz_t e;
+
+	mpz_init(e);
+	rsa_priv_init(&K);
+	generate_keypair_multi(e, &K, key->bits, key->primes, 1);
+	rsa_priv_clear(&K);
+	mpz_clear(e);
+}
+
+static void op_os2ip(struct bench_key *key) {
+	os2ip(key->r, key->C, key->pub.k);
+}
+
+static void op_i2osp(struct bench_key *key) {
+	i2osp(key->X, key->c, key->pub.k);
+}
+
+static void op_rsaep(struct bench_key *key) {
+	rsaep(key->r, key->K.n, key->e, key->m);
+}
+
+static void op_rsadp(struct bench_key *key) {
+	rsadp(key->r, &key->K, key->c);
+}
+
+static void op_rsaes_pkcs1_encrypt(struct bench_key *key) {
+	free(rsaes_pkcs1_encrypt(key->K.n, key->e, key->M, key->pub.k - 11));
+}
+
+static void op_rsads_pkcs1_decrypt(struct bench_key *key) {
+	int mLen;
+
+	free(rsads_pkcs1_decrypt(&key->K, key->pub.k, key->C, &mLen));
+}
+
+static void op_ctx_encrypt(struct bench_key *key) {
+	rsa_ctx_encrypt(&key->pub, key->M, key->pub.k - 11);
+}
+
+static void op_ctx_decrypt(struct bench_key *key) {
+	int mLen;
+
+	rsa_ctx_decrypt(&key->priv, key->C, key->pub.k, &mLen);
+}
+
+static void op_ctx_decrypt_split(struct bench_key *key) {
+	int mLen;
+
+	rsa_ctx_decrypt(&key->split, key->C, key->pub.k, &mLen);
+}
+
+// RSA_BATCH ciphertexts per operation
+static void op_ctx_decrypt_batch(struct bench_key *key) {
+	int mLen[RSA_BATCH];
+
+	rsa_ctx_decrypt_batch_into(&key->priv, key->MB, key->pub.k, mLen, key->CB, RSA_BATCH);
+}
+
+/**
+ * Build a key of 'bits' bits and the inputs of every operation
+ *
+ * return -1 if an error occured
+ */
+static int bench_key_init(struct bench_key *key, int bits, int primes) {
+	unsigned char *out;
+	int i, k;
+
+	key->bits 	= bits;
+	key->primes = primes;
+	mpz_init(key->e);
+	mpz_inits(key->m, key->c, key->r, NULL);
+	rsa_priv_init(&key->K);
+
+	if (-1 == generate_keypair_multi(key->e, &key->K, bits, primes, 1)
+		|| -1 == rsa_ctx_init_pub(&key->pub, key->K.n, key->e)
+		|| -1 == rsa_ctx_init_priv(&key->priv, &key->K)
+		|| -1 == rsa_ctx_init_priv(&key->split, &key->K)
+		|| -1 == rsa_ctx_split(&key->split, 1)) {
+		return -1;
+	}
+
+	k = key->pub.k;
+	key->M = malloc(k);
+	key->C = malloc(k);
+	key->X = malloc(k);
+	key->CB = malloc(RSA_BATCH * k);
+	key->MB = malloc(RSA_BATCH * k);
+	if (NULL == key->M || NULL == key->C || NULL == key->X || NULL == key->CB || NULL == key->MB) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return -1;
+	}
+
+	// M, its ciphertext C, and the representatives m and c = m^e
+	out = NULL;
+	if (0 == rand_bytes(key->M, k - 11) && 0 == rand_bytes(key->X, k)) {
+		out = rsa_ctx_encrypt(&key->pub, key->M, k - 11);
+	}
+	if (NULL == out) {
+		return -1;
+	}
+	memcpy(key->C, out, k);
+	for (i=0; i<RSA_BATCH; i++) {
+		memcpy(key->CB + i * k, out, k);
+	}
+
+	// any value below n
+	os2ip(key->m, key->X, k);
+	mpz_mod(key->m, key->m, key->K.n);
+	mpz_powm(key->c, key->m, key->e, key->K.n);
+
+	return 0;
+}
+
+static void bench_key_clear(struct bench_key *key) {
+	rsa_ctx_clear(&key->pub);
+	rsa_ctx_clear(&key->priv);
+	rsa_ctx_clear(&key->split);
+	rsa_priv_clear(&key->K);
+	mpz_clears(key->e, key->m, key->c, key->r, NULL);
+	free(key->M);
+	free(key->C);
+	free(key->X);
+	free(key->CB);
+	free(key->MB);
+}
+
+/**
+ * Check the exponentiation kernels against mpz_powm on random values
+ * below n: the fixed-size Montgomery kernels of the context (each
+ * prime, or n), with random exponents, then RSAEP and whole RSADPs through the
+ * contexts (low-latency mode included) and the multi-buffer batch
+ *
+ * return the number of mismatches
+ */
+static int bench_verify(struct bench_key *key) {
+	// vars
+	mpz_ptr msgs[BENCH_VERIFY_BATCH], ciphers[BENCH_VERIFY_BATCH];
+	mpz_t x, e, expected, got, batch[BENCH_VERIFY_BATCH], cbatch[BENCH_VERIFY_BATCH], mi[RSA_MAX_PRIMES];
+	mpz_ptr mod[RSA_MAX_PRIMES];
+	int k = key->pub.k, bad = 0, i, j, count;
+
+	mpz_inits(x, e, expected, got, NULL);
+	for (j=0; j<BENCH_VERIFY_BATCH; j++) {
+		mpz_init(batch[j]);
+		mpz_init(cbatch[j]);
+		msgs[j] 	= batch[j];
+		ciphers[j]  = cbatch[j];
+	}
+	for (j=0; j<RSA_MAX_PRIMES; j++) {
+		mpz_init(mi[j]);
+	}
+	mod[0] = key->K.crt ? key->K.p : key->K.n;
+	mod[1] = key->K.q;
+	for (j=2; j<key->K.u; j++) {
+		mod[j] = key->K.r[j-2];
+	}
+
+	for (i=0; i<BENCH_VERIFY; i++) {
+		if (-1 == rand_bytes(key->X, k)) {
+			bad++;
+			break;
+		}
+		os2ip(x, key->X, k);
+		mpz_mod(x, x, key->K.n);
+
+		// the kernels alone, any exponent
+		for (j=0; j<key->K.u; j++) {
+			if (0 == key->priv.mont[j].n) {
+				continue;
+			}
+			os2ip(e, key->X, (i % k) + 1);
+			mpz_powm(expected, x, e, mod[j]);
+			mpz_mod(got, x, mod[j]);
+			if (-1 == mont_powm(got, got, e, &key->priv.mont[j]) || mpz_cmp(got, expected) != 0) {
+				bad++;
+			}
+		}
+
+		// m^e mod n
+		mpz_powm(expected, x, key->e, key->K.n);
+		rsa_ctx_rsaep(&key->pub, got, x);
+		bad += mpz_cmp(got, expected) != 0;
+
+		// c^d mod n
+		mpz_powm(expected, x, key->K.d, key->K.n);
+		rsa_ctx_rsadp(&key->priv, got, x);
+		bad += mpz_cmp(got, expected) != 0;
+		rsa_ctx_rsadp(&key->split, got, x);
+		bad += mpz_cmp(got, expected) != 0;
+
+		// a different ciphertext per lane, an edge value (0, 1 or n - 1)
+		// among them, 1 to BENCH_VERIFY_BATCH of them
+		count = 1 + i % BENCH_VERIFY_BATCH;
+		for (j=0; j<count; j++) {
+			if (-1 == rand_bytes(key->X, k)) {
+				bad++;
+				break;
+			}
+			os2ip(cbatch[j], key->X, k);
+			mpz_mod(cbatch[j], cbatch[j], key->K.n);
+		}
+		j = i % count;
+		if (i % 3 == 2) {
+			mpz_sub_ui(cbatch[j], key->K.n, 1);
+		} else {
+			mpz_set_ui(cbatch[j], i % 3);
+		}
+
+		bad += -1 == rsadp_batch(msgs, &key->K, ciphers, count);
+		for (j=0; j<count; j++) {
+			if (key->K.crt) {
+				rsadp_crt(expected, &key->K, cbatch[j], mi, NULL);
+			} else {
+				rsadp(expected, &key->K, cbatch[j]);
+			}
+			bad += mpz_cmp(batch[j], expected) != 0;
+		}
+
+		// one ciphertext out of range fails the batch
+		mpz_add_ui(cbatch[i % count], key->K.n, i % 2);
+		bad += -1 != rsadp_batch(msgs, &key->K, ciphers, count) || RSA_EINVAL != rsa_errcode();
+	}
+
+	mpz_clears(x, e, expected, got, NULL);
+	for (j=0; j<BENCH_VERIFY_BATCH; j++) {
+		mpz_clear(batch[j]);
+		mpz_clear(cbatch[j]);
+	}
+	for (j=0; j<RSA_MAX_PRIMES; j++) {
+		mpz_clear(mi[j]);
+	}
+
+	fprintf(stderr, "%5d  verify: %d values, kernels %s%s, %d mismatches\n", key->bits, BENCH_VERIFY,
+		key->priv.mont[0].n ? "mulx" : "gmp", mb_available() ? " + ifma batch" : "", bad);
+	return bad;
+}
+
+/**
+ * Run op until the time budget is spent (at least BENCH_MIN_ITERS
+ * times), then print its throughput and latency percentiles
+ */
+static void bench_run(struct bench *bench, struct bench_key *key, char *name, bench_op op) {
+	double start, t, total;
+	int count;
+
+	count = 0;
+	total = 0;
+	start = now_us();
+	while (count < BENCH_MAX_ITERS
+		&& (count < BENCH_MIN_ITERS || now_us() - start < bench->budget * 1e6)) {
+		t = now_us();
+		op(key);
+		bench->samples[count] = now_us() - t;
+		total += bench->samples[count++];
+	}
+
+	qsort(bench->samples, count, sizeof(double), compare_double);
+
+	if (bench->json) {
+		printf("%s\n    {\"bits\": %d, \"op\": \"%s\", \"iterations\": %d, \"ops_per_sec\": %.2f, "
+			"\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}",
+			bench->first ? "" : ",", key->bits, name, count, count / total * 1e6,
+			percentile(bench->samples, count, 50), percentile(bench->samples, count, 90),
+			percentile(bench->samples, count, 99), bench->samples[count-1]);
+		bench->first = 0;
+	} else {
+		printf("%5d  %-22s %8d %12.1f %12.2f %12.2f %12.2f %12.2f\n",
+			key->bits, name, count, count / total * 1e6,
+			percentile(bench->samples, count, 50), percentile(bench->samples, count, 90),
+			percentile(bench->samples, count, 99), bench->samples[count-1]);
+	}
+	fflush(stdout);
+}
+
+static void usage(char *name) {
+	printf("Usage: %s [--json] [--verify] [--time SECONDS] [--sizes 1024,2048,3072,4096] [--primes 2|3|4] [--arena|--arena-secure]\n", name);
+}
+
+int main(int argc, char **argv) {
+	// vars
+	struct bench bench;
+	struct bench_key key;
+	int sizes[BENCH_MAX_SIZES] = { 1024, 2048, 3072, 4096 };
+	int nb_sizes, nb_primes, i;
+	char *size;
+
+	bench.budget = 1.0;
+	bench.json 	 = 0;
+	bench.first  = 1;
+	bench.verify = 0;
+	nb_sizes 	 = 4;
+	nb_primes 	 = 2;
+
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "--json") == 0) {
+			bench.json = 1;
+		} else if (strcmp(argv[i], "--verify") == 0) {
+			bench.verify = 1;
+		} else if (strcmp(argv[i], "--arena") == 0 || strcmp(argv[i], "--arena-secure") == 0) {
+			if (-1 == rsa_alloc_install(strcmp(argv[i], "--arena") == 0 ? 0 : RSA_ALLOC_SECURE)) {
+				fprintf(stderr, "%s\n", rsa_errmsg());
+				return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--time") == 0 && i+1 < argc) {
+			bench.budget = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--primes") == 0 && i+1 < argc) {
+			nb_primes = atoi(argv[++i]);
+			if (nb_primes < 2 || nb_primes > RSA_MAX_PRIMES) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--sizes") == 0 && i+1 < argc) {
+			nb_sizes = 0;
+			for (size=strtok(argv[++i], ","); NULL != size && nb_sizes < BENCH_MAX_SIZES; size=strtok(NULL, ",")) {
+				sizes[nb_sizes++] = atoi(size);
+			}
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	bench.samples = malloc(BENCH_MAX_ITERS * sizeof(double));
+	if (NULL == bench.samples) {
+		printf("Memory error.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (bench.json) {
+		printf("{\n  \"budget_sec\": %.2f,\n  \"limb_bits\": %d,\n  \"primes\": %d,\n  \"results\": [",
+			bench.budget, GMP_LIMB_BITS, nb_primes);
+	} else {
+		printf("%5s  %-22s %8s %12s %12s %12s %12s %12s\n",
+			"bits", "operation", "iters", "ops/s", "p50 us", "p90 us", "p99 us", "max us");
+	}
+
+	for (i=0; i<nb_sizes; i++) {
+		if (sizes[i] < RSA_MIN_BITS || sizes[i] > RSA_MAX_BITS || sizes[i] / nb_primes < RSA_MIN_PRIME_BITS) {
+			fprintf(stderr, "Skipping unsupported size %d\n", sizes[i]);
+			continue;
+		}
+
+		if (-1 == bench_key_init(&key, sizes[i], nb_primes)) {
+			fprintf(stderr, "%s\n", rsa_errmsg());
+			return EXIT_FAILURE;
+		}
+
+		if (bench.verify && bench_verify(&key) != 0) {
+			return EXIT_FAILURE;
+		}
+
+		bench_run(&bench, &key, "generate_prime", op_generate_prime);
+		bench_run(&bench, &key, "generate_keypair", op_generate_keypair);
+		bench_run(&bench, &key, "os2ip", op_os2ip);
+		bench_run(&bench, &key, "i2osp", op_i2osp);
+		bench_run(&bench, &key, "rsaep", op_rsaep);
+		bench_run(&bench, &key, "rsadp", op_rsadp);
+		bench_run(&bench, &key, "rsaes_pkcs1_encrypt", op_rsaes_pkcs1_encrypt);
+		bench_run(&bench, &key, "rsads_pkcs1_decrypt", op_rsads_pkcs1_decrypt);
+		bench_run(&bench, &key, "rsa_ctx_encrypt", op_ctx_encrypt);
+		bench_run(&bench, &key, "rsa_ctx_decrypt", op_ctx_decrypt);
+		bench_run(&bench, &key, "rsa_ctx_decrypt_split", op_ctx_decrypt_split);
+		bench_run(&bench, &key, "rsa_ctx_decrypt_batch", op_ctx_decrypt_batch);
+
+		bench_key_clear(&key);
+	}
+
+	if (bench.json) {
+		printf("\n  ]\n}\n");
+	}
+
+	free(bench.samples);
+	return EXIT_SUCCESS;
+}
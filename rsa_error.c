@@ -0,0 +1,40 @@
+/*
+ * File: rsa_error.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "rsa_error.h"
+
+// last error of each thread
+static __thread int errcode;
+static __thread char errmsg[RSA_ERRMSG_SIZE];
+
+/**
+ * Code of the last error of the calling thread (RSA_OK if none)
+ */
+int rsa_errcode(void) {
+	return errcode;
+}
+
+/**
+ * Message of the last error of the calling thread ("" if none)
+ */
+const char * rsa_errmsg(void) {
+	return errmsg;
+}
+
+/**
+ * Record an error for the calling thread, the message is formatted as
+ * by printf
+ */
+void rsa_error(int code, const char *fmt, ...) {
+	va_list ap;
+
+	errcode = code;
+	va_start(ap, fmt);
+	vsnprintf(errmsg, sizeof(errmsg), fmt, ap);
+	va_end(ap);
+}
@@ -0,0 +1,31 @@
+/*
+ * File: rsa_error.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_ERROR_
+#define _H_RSA_ERROR_
+
+/**
+ * Errors of the library: a function failing returns -1 (or NULL) and
+ * records a code and a message for the calling thread, read back with
+ * rsa_errcode and rsa_errmsg. The library never prints nor exits.
+ */
+#define RSA_OK 			0
+#define RSA_ENOMEM 		1 	// memory allocation failed
+#define RSA_EINVAL 		2 	// invalid argument or length
+#define RSA_EDECRYPT 	3 	// decryption error (padding, representative)
+#define RSA_EKEY 		4 	// key file missing, malformed or of another key
+#define RSA_EIO 		5 	// read, write or map error
+#define RSA_EFORMAT 	6 	// malformed encrypted file
+#define RSA_ERANDOM 	7 	// no entropy source
+#define RSA_ETHREAD 	8 	// thread creation failed
+
+// longest message kept, terminating zero included
+#define RSA_ERRMSG_SIZE 	256
+
+int rsa_errcode(void);
+const char * rsa_errmsg(void);
+void rsa_error(int code, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // _H_RSA_ERROR_
@@ -7,10 +7,45 @@
 #include <stdio.h>
 #include <gmp.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rsa_error.h"
+#include "rsa.h"
+#include "rsa_keys.h"
 
 #define BASE_SAVE 		61
 #define MAX_CHARS_LINES 50
 
+// binary key files
+#define KEY_MAGIC 		"QRSK"
+#define KEY_VERSION 	1
+#define KEY_PUBLIC 		0
+#define KEY_PRIVATE 	1
+#define KEY_CRT_FIELDS 	7 	// d/n and the quintuple
+#define KEY_MAX_FIELDS 	(KEY_CRT_FIELDS + 3 * (RSA_MAX_PRIMES - 2))
+
+/**
+ * Header of a binary key file, followed by nb_fields fields:
+ *  uint64_t nb_limbs | mp_limb_t limbs[nb_limbs] (least significant first)
+ * The limbs are stored in the native byte order and size (limb_bits),
+ * so that they can be used in place once the file is mapped.
+ * checksum is the FNV-1a hash of everything after the header.
+ */
+struct key_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t type;
+	uint32_t bits; 		// bit length of n
+	uint32_t limb_bits;
+	uint32_t nb_fields;
+	uint32_t reserved;
+	uint64_t checksum;
+};
+
 /**
  * Write chars (i.e. n_str, d_str, e_str) to a file (fp)
  */
@@ -18,7 +53,7 @@ int write_chars(char *str, int count, FILE *fp) {
 	int i, count_bis;
 	
 	count_bis = count;
-	for (i=0; i<strlen(str); i++) {
+	for (i=0; i<(int) strlen(str); i++) {
 		fputc(str[i], fp);
 		count_bis++;
 		
@@ -32,243 +67,563 @@ int write_chars(char *str, int count, FILE *fp) {
 }
 
 /**
- * Save the private and public key pair to a new dir .rsa
+ * Write the fields of a key (separated by '/') to a file (fp),
+ * MAX_CHARS_LINES chars per line
  * 
  * return -1 if an error occured
  */
-int save_keypair(mpz_t n, mpz_t e, mpz_t d) {
+int write_fields(mpz_ptr *fields, int nb_fields, FILE *fp) {
+	char *str;
+	int i, count;
+	
+	count = 0;
+	for (i=0; i<nb_fields; i++) {
+		if (i > 0) {
+			count = write_chars("/", count, fp);
+		}
+		
+		// allocating
+		str = malloc((mpz_sizeinbase(fields[i], BASE_SAVE)+2) * sizeof(char));
+		if (NULL == str) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+			return -1;
+		}
+		mpz_get_str(str, BASE_SAVE, fields[i]);
+		
+		count = write_chars(str, count, fp);
+		free(str);
+	}
+	
+	return 0;
+}
+
+/**
+ * Read the fields of a key file (separated by '/') enclosed between
+ * the lines 'begin' and 'end'. Line breaks are skipped.
+ * 
+ * fields[0] holds the whole buffer and must be freed by the caller
+ * return the number of fields read, -1 if an error occured
+ */
+int read_fields(char *filename, char *begin, char *end, char **fields, int max_fields) {
 	// vars
 	FILE *fp_rsa;
-	char *n_str, *e_str, *d_str;
-	int i, count;
+	char *content, *body, *body_end, *str;
+	long size;
+	int nb_fields;
 	
-	// saving public key
-	fp_rsa = fopen(".rsa/rsa.pub", "w");
+	fp_rsa = fopen(filename, "r");
 	if (NULL == fp_rsa) {
-		printf("Unable to open '.rsa/rsa.pub' for write operation. Aborting.\n");
+		rsa_error(RSA_EKEY, "File '%s' doesn't exists. Aborting.", filename);
 		return -1;
 	}
 	
-	// allocating
-	e_str = malloc((mpz_sizeinbase(e, BASE_SAVE)+2) * sizeof(char));
-	memset(e_str, '\0', sizeof(e_str));
-	mpz_get_str(e_str, BASE_SAVE, e);
+	// size of the key file
+	fseek(fp_rsa, 0, SEEK_END);
+	size = ftell(fp_rsa);
+	rewind(fp_rsa);
 	
-	fputs("--- BEGIN PUBLIC KEY ---\n", fp_rsa);
-	fputs(e_str, fp_rsa);	
-	fputc('/', fp_rsa);
+	content = malloc((size + 1) * sizeof(char));
+	if (NULL == content) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		fclose(fp_rsa);
+		return -1;
+	}
 	
-	count = strlen(e_str) + 1;
-	free(e_str);
+	size = fread(content, sizeof(char), size, fp_rsa);
+	content[size] = '\0';
+	fclose(fp_rsa);
 	
-	// allocating
-	n_str = malloc((mpz_sizeinbase(n, BASE_SAVE)+2) * sizeof(char));
-	mpz_get_str(n_str, BASE_SAVE, n);
+	// checking begin and end lines
+	body 	 = strstr(content, begin);
+	body_end = strstr(content, end);
+	if (NULL == body || NULL == body_end || body_end < body) {
+		rsa_error(RSA_EKEY, "Malformed key file '%s'. Aborting.", filename);
+		free(content);
+		return -1;
+	}
+	body += strlen(begin);
 	
-	write_chars(n_str, count, fp_rsa);
+	// removing line breaks and splitting on '/'
+	nb_fields = 1;
+	fields[0] = content;
+	for (str=content; body<body_end; body++) {
+		if (*body == '\n') {
+			continue;
+		}
+		
+		if (*body == '/') {
+			*str++ = '\0';
+			if (nb_fields == max_fields) {
+				rsa_error(RSA_EKEY, "Malformed key file '%s'. Aborting.", filename);
+				free(content);
+				return -1;
+			}
+			fields[nb_fields++] = str;
+			continue;
+		}
+		
+		*str++ = *body;
+	}
+	*str = '\0';
 	
-	fputs("\n--- END PUBLIC KEY ---\n", fp_rsa);
-	fclose(fp_rsa);
+	return nb_fields;
+}
+
+/**
+ * FNV-1a hash of len octets, continuing from h
+ */
+uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+	const unsigned char *octets = data;
+	size_t i;
+	
+	for (i=0; i<len; i++) {
+		h ^= octets[i];
+		h *= 0x100000001b3ULL;
+	}
+	
+	return h;
+}
+
+/**
+ * Fingerprint of a public key: FNV-1a of n, as k octets (big-endian)
+ * 
+ * return 0, which matches no key, if memory is missing
+ */
+uint64_t key_fingerprint(mpz_t n) {
+	unsigned char buffer[RSA_MAX_BITS / 8], *N;
+	uint64_t h;
+	int k;
+
+	// on the stack up to the largest generated keys
+	k = rsa_octets(n);
+	N = (size_t) k <= sizeof(buffer) ? buffer : malloc(k);
+	if (NULL == N) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return 0;
+	}
 
-	// saving private key
-	fp_rsa = fopen(".rsa/rsa.priv", "w");
+	i2osp(N, n, k);
+	h = fnv1a(FNV1A_INIT, N, k);
+
+	if (N != buffer) {
+		free(N);
+	}
+	return h;
+}
+
+/**
+ * Open a key file for writing, truncated
+ * A private key file is readable by its owner only, even when it
+ * already existed
+ * 
+ * return NULL if an error occured
+ */
+FILE * open_key_file(char *filename, int type) {
+	FILE *fp_rsa;
+	int fd;
+	
+	if (KEY_PUBLIC == type) {
+		fp_rsa = fopen(filename, "w");
+	} else {
+		fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+		fp_rsa = NULL;
+		if (-1 != fd && (fchmod(fd, 0600) == -1 || NULL == (fp_rsa = fdopen(fd, "w")))) {
+			close(fd);
+		}
+	}
+	
+	if (NULL == fp_rsa) {
+		rsa_error(RSA_EIO, "Unable to open '%s' for write operation. Aborting.", filename);
+	}
+	return fp_rsa;
+}
+
+/**
+ * Save the fields of a key to a binary key file
+ * 
+ * return -1 if an error occured
+ */
+int save_fields_bin(char *filename, int type, mpz_ptr *fields, int nb_fields, mpz_t n) {
+	// vars
+	struct key_header header;
+	uint64_t nb_limbs;
+	FILE *fp_rsa;
+	int i, written;
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KEY_MAGIC, 4);
+	header.version 	 = KEY_VERSION;
+	header.type 	 = type;
+	header.bits 	 = mpz_sizeinbase(n, 2);
+	header.limb_bits = GMP_LIMB_BITS;
+	header.nb_fields = nb_fields;
+	
+	// checksum of the fields
+	header.checksum = FNV1A_INIT;
+	for (i=0; i<nb_fields; i++) {
+		nb_limbs = mpz_size(fields[i]);
+		header.checksum = fnv1a(header.checksum, &nb_limbs, sizeof(nb_limbs));
+		header.checksum = fnv1a(header.checksum, mpz_limbs_read(fields[i]), nb_limbs * sizeof(mp_limb_t));
+	}
+	
+	fp_rsa = open_key_file(filename, type);
 	if (NULL == fp_rsa) {
-		printf("Unable to open '.rsa/rsa.priv' for write operation. Aborting.\n");
 		return -1;
 	}
 	
-	fputs("--- BEGIN PRIVATE KEY ---\n", fp_rsa);
+	written = fwrite(&header, sizeof(header), 1, fp_rsa) == 1;
+	for (i=0; i<nb_fields && written; i++) {
+		nb_limbs = mpz_size(fields[i]);
+		written = fwrite(&nb_limbs, sizeof(nb_limbs), 1, fp_rsa) == 1
+			&& fwrite(mpz_limbs_read(fields[i]), sizeof(mp_limb_t), nb_limbs, fp_rsa) == nb_limbs;
+	}
+	
+	if (fclose(fp_rsa) != 0 || !written) {
+		rsa_error(RSA_EIO, "Unable to write '%s'. Aborting.", filename);
+		return -1;
+	}
+	
+	return 0;
+}
+
+/**
+ * Map a binary key file and point 'fields' at its integers, without
+ * copying them (the integers are read-only and live with the mapping)
+ * 
+ * return the mapping (of length map_len), NULL if an error occured
+ */
+void * map_fields_bin(char *filename, int type, mpz_ptr *fields, int *nb_fields, size_t *map_len) {
+	// vars
+	struct key_header *header;
+	unsigned char *map, *field, *end;
+	struct stat st;
+	uint64_t nb_limbs;
+	int fd, i;
+	
+	fd = open(filename, O_RDONLY);
+	if (-1 == fd) {
+		rsa_error(RSA_EKEY, "File '%s' doesn't exists. Aborting.", filename);
+		return NULL;
+	}
+	
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*header)) {
+		rsa_error(RSA_EKEY, "Malformed key file '%s'.", filename);
+		close(fd);
+		return NULL;
+	}
+	
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		rsa_error(RSA_EIO, "Unable to map '%s'.", filename);
+		return NULL;
+	}
+	
+	// checking the header
+	header = (struct key_header *) map;
+	end    = map + st.st_size;
+	if (memcmp(header->magic, KEY_MAGIC, 4) != 0 || header->version != KEY_VERSION
+		|| header->type != type || header->nb_fields > (uint32_t) *nb_fields) {
+		rsa_error(RSA_EKEY, "Malformed key file '%s'.", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	if (header->limb_bits != GMP_LIMB_BITS) {
+		rsa_error(RSA_EKEY, "Key file '%s' was saved with %u-bit limbs.", filename, header->limb_bits);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	if (fnv1a(FNV1A_INIT, map + sizeof(*header), st.st_size - sizeof(*header)) != header->checksum) {
+		rsa_error(RSA_EKEY, "Bad checksum for key file '%s'.", filename);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	// pointing the integers at the limbs
+	field = map + sizeof(*header);
+	for (i=0; i<(int) header->nb_fields; i++) {
+		if ((size_t) (end - field) < sizeof(nb_limbs)) {
+			rsa_error(RSA_EKEY, "Malformed key file '%s'.", filename);
+			munmap(map, st.st_size);
+			return NULL;
+		}
+		memcpy(&nb_limbs, field, sizeof(nb_limbs));
+		field += sizeof(nb_limbs);
+		
+		// field <= end from here on
+		if (nb_limbs > (size_t) (end - field) / sizeof(mp_limb_t)) {
+			rsa_error(RSA_EKEY, "Malformed key file '%s'.", filename);
+			munmap(map, st.st_size);
+			return NULL;
+		}
+		
+		mpz_roinit_n(fields[i], (mp_limb_t *) field, nb_limbs);
+		field += nb_limbs * sizeof(mp_limb_t);
+	}
+	
+	// n comes second in both key types, and must be of the recorded size
+	if (header->nb_fields < 2 || mpz_sizeinbase(fields[1], 2) != header->bits) {
+		rsa_error(RSA_EKEY, "Key file '%s' does not hold a %u-bit modulus.", filename, header->bits);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	
+	*nb_fields = header->nb_fields;
+	*map_len   = st.st_size;
+	return map;
+}
+
+/**
+ * Point priv at the fields of a private key, in the order of the key
+ * files: d/n/p/q/dP/dQ/qInv, then r_i/d_i/t_i for i = 3, ..., u
+ * (RSA_MAX_PRIMES - 2 triplets at most)
+ * 
+ * return the number of fields of K, 2 without the quintuple
+ */
+static int priv_fields(struct rsa_priv *K, mpz_ptr *priv) {
+	int i;
+	
+	priv[0] = K->d; priv[1] = K->n; priv[2] = K->p; priv[3] = K->q;
+	priv[4] = K->dP; priv[5] = K->dQ; priv[6] = K->qInv;
+	for (i=0; i<RSA_MAX_PRIMES-2; i++) {
+		priv[KEY_CRT_FIELDS + 3*i]     = K->r[i];
+		priv[KEY_CRT_FIELDS + 3*i + 1] = K->di[i];
+		priv[KEY_CRT_FIELDS + 3*i + 2] = K->ti[i];
+	}
+	
+	return K->crt ? KEY_CRT_FIELDS + 3 * (K->u - 2) : 2;
+}
+
+/**
+ * Number of primes of a private key of nb_fields fields
+ * 
+ * return 0 if no key has that many fields (2 for the pair (n, d))
+ */
+static int priv_primes(int nb_fields) {
+	if (2 == nb_fields) {
+		return 2;
+	}
+	
+	if (nb_fields < KEY_CRT_FIELDS || nb_fields > KEY_MAX_FIELDS || (nb_fields - KEY_CRT_FIELDS) % 3 != 0) {
+		return 0;
+	}
+	
+	return 2 + (nb_fields - KEY_CRT_FIELDS) / 3;
+}
+
+/**
+ * Save the private and public key pair to a new dir .rsa
+ * The private key is saved in its quintuple form, after (d, n), and
+ * the triplets of a multi-prime key follow:
+ *  d/n/p/q/dP/dQ/qInv[/r3/d3/t3[/r4/d4/t4]]
+ * 
+ * return -1 if an error occured
+ */
+int save_keypair(mpz_t e, struct rsa_priv *K) {
+	// vars
+	FILE *fp_rsa;
+	mpz_ptr pub[]  = { e, K->n };
+	mpz_ptr priv[KEY_MAX_FIELDS];
+	int nb_fields;
 	
-	// allocating
-	d_str = malloc((mpz_sizeinbase(d, BASE_SAVE)+2) * sizeof(char));
-	mpz_get_str(d_str, BASE_SAVE, d);
+	nb_fields = priv_fields(K, priv);
 	
-	count = write_chars(d_str, 0, fp_rsa);
-	free(d_str);
+	// saving public key
+	fp_rsa = fopen(".rsa/rsa.pub", "w");
+	if (NULL == fp_rsa) {
+		rsa_error(RSA_EIO, "Unable to open '.rsa/rsa.pub' for write operation. Aborting.");
+		return -1;
+	}
 	
-	fputc('/', fp_rsa);
-	write_chars(n_str, count+1, fp_rsa);
+	fputs("--- BEGIN PUBLIC KEY ---\n", fp_rsa);
+	if (-1 == write_fields(pub, 2, fp_rsa)) {
+		fclose(fp_rsa);
+		return -1;
+	}
+	fputs("\n--- END PUBLIC KEY ---\n", fp_rsa);
+	fclose(fp_rsa);
+
+	// saving private key, readable by its owner only
+	fp_rsa = open_key_file(".rsa/rsa.priv", KEY_PRIVATE);
+	if (NULL == fp_rsa) {
+		return -1;
+	}
 	
-	free(n_str);
+	fputs("--- BEGIN PRIVATE KEY ---\n", fp_rsa);
+	if (-1 == write_fields(priv, nb_fields, fp_rsa)) {
+		fclose(fp_rsa);
+		return -1;
+	}
 	fputs("\n--- END PRIVATE KEY ---\n", fp_rsa);
 
 	// closing file
 	fclose(fp_rsa);
 	
+	// binary key files
+	if (-1 == save_fields_bin(".rsa/rsa.pub.bin", KEY_PUBLIC, pub, 2, K->n)
+		|| -1 == save_fields_bin(".rsa/rsa.priv.bin", KEY_PRIVATE, priv, nb_fields, K->n)) {
+		return -1;
+	}
+	
 	return 0;
 }
 
 /**
- * Load private key into n and d
+ * Load private key into K from '.rsa/rsa.priv.bin'
+ * The integers of K point into the mapped file
  */
-int load_priv(mpz_t n, mpz_t d) {
+int load_priv_bin(struct rsa_priv *K) {
 	// vars
-	FILE *fp_rsa_pub, *lines_cmd;
-	char *d_str;
-	char *n_str, line[MAX_CHARS_LINES], char_pub;
-	int chars, i, step, count;
+	mpz_ptr priv[KEY_MAX_FIELDS];
+	int nb_fields, i;
+	
+	// fields missing from the file are left to 0
+	K->crt = 0;
+	priv_fields(K, priv);
+	for (i=0; i<KEY_MAX_FIELDS; i++) {
+		mpz_roinit_n(priv[i], NULL, 0);
+	}
 	
-	// public key
-	fp_rsa_pub = fopen(".rsa/rsa.priv", "r");
+	nb_fields = KEY_MAX_FIELDS;
+	K->map = map_fields_bin(".rsa/rsa.priv.bin", KEY_PRIVATE, priv, &nb_fields, &K->map_len);
+	if (NULL == K->map) {
+		return -1;
+	}
 	
-	// existance
-	if (NULL == fp_rsa_pub) {
-		printf("File '.rsa/rsa.priv' doesn't exists. Aborting.\n");
+	K->u = priv_primes(nb_fields);
+	if (0 == K->u) {
+		rsa_error(RSA_EKEY, "Malformed key file '.rsa/rsa.priv.bin'.");
+		munmap(K->map, K->map_len);
+		K->map = NULL;
+		K->u   = 2;
 		return -1;
 	}
 	
-	// counting lines
-	lines_cmd = popen("wc -m < .rsa/rsa.pub", "r");
-	fgets(line, 10, lines_cmd);
-	chars = atoi(line); // removing first and last line
-	pclose(lines_cmd);
+	K->crt = (nb_fields != 2);
+	return 0;
+}
+
+/**
+ * Load public key into n and e from '.rsa/rsa.pub.bin'
+ * The limbs are copied, the file is not kept mapped
+ */
+int load_pub_bin(mpz_t n, mpz_t e) {
+	// vars
+	__mpz_struct fields[2];
+	mpz_ptr pub[] = { &fields[0], &fields[1] };
+	size_t map_len;
+	void *map;
+	int nb_fields;
+	
+	nb_fields = 2;
+	map = map_fields_bin(".rsa/rsa.pub.bin", KEY_PUBLIC, pub, &nb_fields, &map_len);
+	if (NULL == map) {
+		return -1;
+	}
 	
-	// allocating e_str (will never change: HbN)
-	d_str = malloc(chars * sizeof(char *));
-	if (NULL == d_str) {
-		printf("Memory error.\n");
-		exit(1);
+	if (nb_fields != 2) {
+		rsa_error(RSA_EKEY, "Malformed key file '.rsa/rsa.pub.bin'.");
+		munmap(map, map_len);
+		return -1;
 	}
 	
-	memset(d_str, '\0', chars);
+	mpz_init_set(e, pub[0]);
+	mpz_init_set(n, pub[1]);
+	munmap(map, map_len);
 	
-	// allocating n_str (some \n will remain...)
-	n_str 	 = (char *) malloc(chars * sizeof(char *));
-	if (NULL == n_str) {
-		printf("Memory error.\n");
-		free(d_str);
-		exit(1);
+	return 0;
+}
+
+/**
+ * Load private key into K
+ * The binary key file is used when there is one, the text one otherwise
+ * Keys holding only (d, n) are loaded without the CRT values
+ */
+int load_priv(struct rsa_priv *K) {
+	if (access(".rsa/rsa.priv.bin", R_OK) == 0 && load_priv_bin(K) == 0) {
+		return 0;
 	}
 	
-	memset(n_str, '\0', chars);
+	return load_priv_text(K);
+}
+
+/**
+ * Load private key into K from '.rsa/rsa.priv'
+ */
+int load_priv_text(struct rsa_priv *K) {
+	// vars
+	char *fields[KEY_MAX_FIELDS];
+	mpz_ptr priv[KEY_MAX_FIELDS];
+	int nb_fields, i;
 	
-	step = 1;
-	count = 0;
-	while (fgets(line, MAX_CHARS_LINES+2, fp_rsa_pub) != NULL) {
-		// skipping first line
-		if (strcmp(line, "--- BEGIN PRIVATE KEY ---\n") == 0) {
-			continue;
-		}
-		
-		// skipping last line
-		if (strcmp(line, "--- END PRIVATE KEY ---\n") == 0) {
-			fclose(fp_rsa_pub);
-			break;	
-		}
-		
-		// checking the space char
-		for (i=0; i<MAX_CHARS_LINES; i++) {
-			// step 2
-			if (line[i] == '/') {
-				count = 0;
-				step = 2;
-				continue;
-			}
-			
-			// step 1, filling e_str
-			if (step == 1 && line[i] != '\n') {
-				d_str[count] = line[i];
-				count++;
-			}
-			
-			// step 2, filling n_str
-			if (step == 2 && line[i] != '\n') {
-				n_str[count] = line[i];
-				count++;
-			}
-		}
+	nb_fields = read_fields(".rsa/rsa.priv", "--- BEGIN PRIVATE KEY ---\n",
+		"--- END PRIVATE KEY ---", fields, KEY_MAX_FIELDS);
+	if (-1 == nb_fields) {
+		return -1;
+	}
+	
+	if (0 == priv_primes(nb_fields)) {
+		rsa_error(RSA_EKEY, "Malformed key file '.rsa/rsa.priv'. Aborting.");
+		free(fields[0]);
+		return -1;
 	}
 	
 	// inits
-	mpz_inits(n, d, NULL);
+	rsa_priv_init(K);
+	priv_fields(K, priv);
 	
-	// converting 
-	mpz_set_str(n, n_str, BASE_SAVE);
-	free(n_str);
-	mpz_set_str(d, d_str, BASE_SAVE);
-	free(d_str);
-
+	// converting
+	for (i=0; i<nb_fields; i++) {
+		mpz_set_str(priv[i], fields[i], BASE_SAVE);
+	}
+	free(fields[0]);
+	
+	K->u   = priv_primes(nb_fields);
+	K->crt = (nb_fields != 2);
 	return 0;
 }
 
 /**
  * Load public key into n and e
+ * The binary key file is used when there is one, the text one otherwise
  */
 int load_pub(mpz_t n, mpz_t e) {
-	// vars
-	FILE *fp_rsa_pub, *lines_cmd;
-	char *n_str, *e_str, line[MAX_CHARS_LINES], char_pub;
-	int chars, i, step, count;
+	if (access(".rsa/rsa.pub.bin", R_OK) == 0 && load_pub_bin(n, e) == 0) {
+		return 0;
+	}
 	
-	// public key
-	fp_rsa_pub = fopen(".rsa/rsa.pub", "r");
+	return load_pub_text(n, e);
+}
+
+/**
+ * Load public key into n and e from '.rsa/rsa.pub'
+ */
+int load_pub_text(mpz_t n, mpz_t e) {
+	// vars
+	char *fields[2];
+	int nb_fields;
 	
-	// existance
-	if (NULL == fp_rsa_pub) {
-		printf("File '.rsa/rsa.pub' doesn't exists. Aborting.\n");
+	nb_fields = read_fields(".rsa/rsa.pub", "--- BEGIN PUBLIC KEY ---\n",
+		"--- END PUBLIC KEY ---", fields, 2);
+	if (-1 == nb_fields) {
 		return -1;
 	}
 	
-	// counting lines
-	lines_cmd = popen("wc -m < .rsa/rsa.pub", "r");
-	fgets(line, 10, lines_cmd);
-	chars = atoi(line); // removing first and last line
-	pclose(lines_cmd);
-	
-	// allocating e_str (will never change: HbN)
-	e_str 	 = malloc(4 * sizeof(char *));
-	memset(e_str, '\0', sizeof(e_str));
-	
-	// allocating n_str (some \n will remain...)
-	// TODO: allocate the correct space
-	n_str 	 = malloc(chars * sizeof(char *));
-	memset(n_str, '\0', sizeof(n_str));
-	
-	step = 1;
-	count = 0;
-	while (fgets(line, MAX_CHARS_LINES+2, fp_rsa_pub) != NULL) {
-		// skipping first line
-		if (strcmp(line, "--- BEGIN PUBLIC KEY ---\n") == 0) {
-			continue;
-		}
-		
-		// skipping last line
-		if (strcmp(line, "--- END PUBLIC KEY ---\n") == 0) {
-			fclose(fp_rsa_pub);
-			break;	
-		}
-		
-		// checking the space char
-		for (i=0; i<MAX_CHARS_LINES; i++) {
-			// step 2
-			if (line[i] == '/') {
-				count = 0;
-				step = 2;
-				continue;
-			}
-			
-			// step 1, filling e_str
-			if (step == 1 && line[i] != '\n') {
-				e_str[count] = line[i];
-				count++;
-			}
-			
-			// step 2, filling n_str
-			if (step == 2 && line[i] != '\n') {
-				n_str[count] = line[i];
-				count++;
-			}
-		}
+	if (nb_fields != 2) {
+		rsa_error(RSA_EKEY, "Malformed key file '.rsa/rsa.pub'. Aborting.");
+		free(fields[0]);
+		return -1;
 	}
 	
 	// inits
 	mpz_inits(n, e, NULL);
 	
 	// converting 
-	mpz_set_str(n, n_str, BASE_SAVE);
-	free(n_str);
-	mpz_set_str(e, e_str, BASE_SAVE);
-	free(e_str);
+	mpz_set_str(e, fields[0], BASE_SAVE);
+	mpz_set_str(n, fields[1], BASE_SAVE);
+	free(fields[0]);
 
 	return 0;
 }
@@ -6,9 +6,24 @@
 #ifndef _H_RSA_KEYS_
 #define _H_RSA_KEYS_
 
-int save_keypair(mpz_t n, mpz_t e, mpz_t d);
+#include <stdint.h>
+#include <gmp.h>
+
+#include "rsa.h"
+
+#define FNV1A_INIT 		0xcbf29ce484222325ULL
+
+uint64_t fnv1a(uint64_t h, const void *data, size_t len);
+uint64_t key_fingerprint(mpz_t n);
+
+int save_keypair(mpz_t e, struct rsa_priv *K);
 
 int load_pub(mpz_t n, mpz_t e);
-int load_priv(mpz_t n, mpz_t d);
+int load_priv(struct rsa_priv *K);
+
+int load_pub_text(mpz_t n, mpz_t e);
+int load_priv_text(struct rsa_priv *K);
+int load_pub_bin(mpz_t n, mpz_t e);
+int load_priv_bin(struct rsa_priv *K);
 
 #endif
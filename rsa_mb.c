@@ -0,0 +1,344 @@
+/*
+ * File: rsa_mb.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <gmp.h>
+#include <immintrin.h>
+
+#include "rsa_error.h"
+#include "rsa_mb.h"
+
+#define MB_TARGET 		__attribute__((target("avx512f,avx512ifma")))
+#define MB_INLINE 		static inline __attribute__((always_inline)) MB_TARGET
+#define MB_MASK 		((UINT64_C(1) << MB_DIGIT_BITS) - 1)
+#define MB_TABLE 		(1 << MB_WINDOW)
+
+/**
+ * Multi-buffer Montgomery exponentiation with AVX-512 IFMA
+ *
+ * Lane l of every vector belongs to the l-th exponentiation: a number
+ * of N digits is N vectors, digit j of the 8 numbers in vector j. The
+ * digits are radix 2^52, so that vpmadd52luq / vpmadd52huq add the low
+ * and the high half of eight 52x52-bit products at once. The sums are
+ * left unnormalized (64-bit lanes, 12 spare bits) until the end of a
+ * product.
+ *
+ * With R = 2^(52N) > 4m, a product of two numbers below 2m stays below
+ * 2m: no subtraction, and nothing depends on the values.
+ */
+
+/**
+ * r = a * b / R mod m, in [0, 2m), for a, b in [0, 2m)
+ * k0 = -m^(-1) mod 2^52
+ */
+MB_INLINE void mb_mul(__m512i *r, const __m512i *a, const __m512i *b, const __m512i *m, __m512i k0, int N) {
+	__m512i acc[2 * MB_MAX_DIGITS];
+	__m512i zero = _mm512_setzero_si512(), mask = _mm512_set1_epi64(MB_MASK);
+	__m512i ai, q, x, carry;
+	int i, j;
+
+	for (j=0; j<2*N; j++) {
+		acc[j] = zero;
+	}
+
+	// digit by digit: acc += a_i * b + q * m, where q cancels the low digit
+	for (i=0; i<N; i++) {
+		ai = a[i];
+		x  = _mm512_madd52lo_epu64(acc[i], ai, b[0]);
+		q  = _mm512_madd52lo_epu64(zero, x, k0);
+		x  = _mm512_madd52lo_epu64(x, q, m[0]);
+		acc[i+1] = _mm512_add_epi64(acc[i+1], _mm512_srli_epi64(x, MB_DIGIT_BITS));
+
+		for (j=1; j<N; j++) {
+			x = acc[i+j];
+			x = _mm512_madd52lo_epu64(x, ai, b[j]);
+			x = _mm512_madd52lo_epu64(x, q, m[j]);
+			x = _mm512_madd52hi_epu64(x, ai, b[j-1]);
+			x = _mm512_madd52hi_epu64(x, q, m[j-1]);
+			acc[i+j] = x;
+		}
+
+		x = _mm512_madd52hi_epu64(acc[i+N], ai, b[N-1]);
+		acc[i+N] = _mm512_madd52hi_epu64(x, q, m[N-1]);
+	}
+
+	// back to 52-bit digits, the result fits in N of them
+	carry = zero;
+	for (j=0; j<N; j++) {
+		x 	  = _mm512_add_epi64(acc[N+j], carry);
+		r[j]  = _mm512_and_si512(x, mask);
+		carry = _mm512_srli_epi64(x, MB_DIGIT_BITS);
+	}
+}
+
+/**
+ * r = table[idx] in every lane, reading every entry (the indexes are
+ * secret)
+ */
+MB_INLINE void mb_select(__m512i *r, const __m512i *table, __m512i idx, int N) {
+	__mmask8 hit;
+	int t, j;
+
+	for (j=0; j<N; j++) {
+		r[j] = table[j];
+	}
+
+	for (t=1; t<MB_TABLE; t++) {
+		hit = _mm512_cmpeq_epi64_mask(idx, _mm512_set1_epi64(t));
+		for (j=0; j<N; j++) {
+			r[j] = _mm512_mask_mov_epi64(r[j], hit, table[t*N + j]);
+		}
+	}
+}
+
+/**
+ * Fixed-window exponentiation of the Montgomery forms: table[0] holds
+ * R mod m, table[1] the base. windows[w] holds the MB_WINDOW-bit
+ * digits of the exponents, most significant first.
+ * The result, out of the Montgomery form, is in [0, m].
+ */
+MB_INLINE void mb_exp(__m512i *r, __m512i *table, const __m512i *m, __m512i k0,
+					  const __m512i *windows, int nb_windows, int N) {
+	__m512i acc[MB_MAX_DIGITS], sel[MB_MAX_DIGITS];
+	int t, w, s, j;
+
+	for (t=2; t<MB_TABLE; t++) {
+		mb_mul(&table[t*N], &table[(t-1)*N], &table[N], m, k0, N);
+	}
+
+	mb_select(acc, table, windows[0], N);
+	for (w=1; w<nb_windows; w++) {
+		for (s=0; s<MB_WINDOW; s++) {
+			mb_mul(acc, acc, acc, m, k0, N);
+		}
+
+		mb_select(sel, table, windows[w], N);
+		mb_mul(acc, acc, sel, m, k0, N);
+	}
+
+	// times 1: acc / R mod m
+	sel[0] = _mm512_set1_epi64(1);
+	for (j=1; j<N; j++) {
+		sel[j] = _mm512_setzero_si512();
+	}
+	mb_mul(r, acc, sel, m, k0, N);
+}
+
+#define MB_EXP_DEFINE(N) 																\
+MB_TARGET static void mb_exp_##N(__m512i *r, __m512i *table, const __m512i *m, __m512i k0, \
+								 const __m512i *windows, int nb_windows) { 				\
+	mb_exp(r, table, m, k0, windows, nb_windows, N); 									\
+}
+
+// the primes of 2048, 3072 and 4096-bit keys, the other sizes take the
+// generic version
+MB_EXP_DEFINE(20)
+MB_EXP_DEFINE(30)
+MB_EXP_DEFINE(40)
+
+MB_TARGET static void mb_exp_any(__m512i *r, __m512i *table, const __m512i *m, __m512i k0,
+								 const __m512i *windows, int nb_windows, int N) {
+	mb_exp(r, table, m, k0, windows, nb_windows, N);
+}
+
+/**
+ * 52 bits of x from bit 'pos' (0 past the end)
+ */
+static uint64_t mb_bits(mpz_srcptr x, mp_bitcnt_t pos, int len) {
+	const mp_limb_t *limbs = mpz_limbs_read(x);
+	size_t size = mpz_size(x), i = pos / 64;
+	int shift = pos % 64;
+	uint64_t v;
+
+	if (i >= size) {
+		return 0;
+	}
+
+	v = limbs[i] >> shift;
+	if (shift + len > 64 && i+1 < size) {
+		v |= limbs[i+1] << (64 - shift);
+	}
+
+	return v & ((UINT64_C(1) << len) - 1);
+}
+
+/**
+ * Vectors of the N digits of the lanes
+ */
+MB_TARGET static void mb_load(__m512i *v, mpz_ptr *x, int N) {
+	uint64_t lanes[MB_LANES];
+	int j, l;
+
+	for (j=0; j<N; j++) {
+		for (l=0; l<MB_LANES; l++) {
+			lanes[l] = mb_bits(x[l], (mp_bitcnt_t) j * MB_DIGIT_BITS, MB_DIGIT_BITS);
+		}
+		v[j] = _mm512_loadu_si512(lanes);
+	}
+}
+
+/**
+ * x[l] = the N digits of lane l
+ */
+MB_TARGET static void mb_store(mpz_ptr *x, const __m512i *v, int N) {
+	uint64_t lanes[MB_LANES];
+	mp_limb_t *limbs;
+	mp_bitcnt_t pos;
+	int nb_limbs, j, l, shift;
+
+	nb_limbs = (N * MB_DIGIT_BITS + 63) / 64;
+	for (l=0; l<MB_LANES; l++) {
+		limbs = mpz_limbs_write(x[l], nb_limbs);
+		memset(limbs, 0, nb_limbs * sizeof(*limbs));
+	}
+
+	for (j=0; j<N; j++) {
+		_mm512_storeu_si512(lanes, v[j]);
+		pos   = (mp_bitcnt_t) j * MB_DIGIT_BITS;
+		shift = pos % 64;
+		for (l=0; l<MB_LANES; l++) {
+			limbs = mpz_limbs_modify(x[l], nb_limbs);
+			limbs[pos / 64] |= (mp_limb_t) lanes[l] << shift;
+			if (shift > 64 - MB_DIGIT_BITS) {
+				limbs[pos / 64 + 1] |= (mp_limb_t) lanes[l] >> (64 - shift);
+			}
+		}
+	}
+
+	for (l=0; l<MB_LANES; l++) {
+		mpz_limbs_finish(x[l], nb_limbs);
+	}
+}
+
+/**
+ * -m^(-1) mod 2^52, m odd (Newton: each step doubles the correct bits)
+ */
+static uint64_t mb_k0(mpz_srcptr m) {
+	uint64_t m0 = mpz_getlimbn(m, 0), inv = m0;
+	int i;
+
+	for (i=0; i<6; i++) {
+		inv *= 2 - m0 * inv;
+	}
+
+	return (0 - inv) & MB_MASK;
+}
+
+/**
+ * 1 if this CPU has AVX-512 IFMA
+ */
+int mb_available(void) {
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512ifma");
+}
+
+/**
+ * mb_powm on 8 lanes of N digits
+ */
+MB_TARGET static void mb_powm_lanes(mpz_ptr *lr, mpz_ptr *lb, mpz_ptr *le, mpz_ptr *lm, int N, int nb_windows) {
+	// vars
+	__m512i table[MB_TABLE * MB_MAX_DIGITS], mod[MB_MAX_DIGITS], res[MB_MAX_DIGITS];
+	__m512i windows[(MB_MAX_BITS + MB_WINDOW-1) / MB_WINDOW];
+	uint64_t k0[MB_LANES], idx[MB_LANES];
+	mpz_t one[MB_LANES], base[MB_LANES];
+	mpz_ptr pone[MB_LANES], pbase[MB_LANES];
+	int w, l;
+
+	// Montgomery forms of 1 and of the bases: x * R mod m
+	for (l=0; l<MB_LANES; l++) {
+		mpz_inits(one[l], base[l], NULL);
+		mpz_setbit(one[l], (mp_bitcnt_t) N * MB_DIGIT_BITS);
+		mpz_mul_2exp(base[l], lb[l], (mp_bitcnt_t) N * MB_DIGIT_BITS);
+		mpz_mod(base[l], base[l], lm[l]);
+		mpz_mod(one[l], one[l], lm[l]);
+		k0[l] 	 = mb_k0(lm[l]);
+		pone[l]  = one[l];
+		pbase[l] = base[l];
+	}
+	mb_load(table, pone, N);
+	mb_load(&table[N], pbase, N);
+	mb_load(mod, lm, N);
+
+	// exponent digits, most significant first
+	for (w=0; w<nb_windows; w++) {
+		for (l=0; l<MB_LANES; l++) {
+			idx[l] = mb_bits(le[l], (mp_bitcnt_t) (nb_windows-1 - w) * MB_WINDOW, MB_WINDOW);
+		}
+		windows[w] = _mm512_loadu_si512(idx);
+	}
+
+	switch (N) {
+		case 20: mb_exp_20(res, table, mod, _mm512_loadu_si512(k0), windows, nb_windows); break;
+		case 30: mb_exp_30(res, table, mod, _mm512_loadu_si512(k0), windows, nb_windows); break;
+		case 40: mb_exp_40(res, table, mod, _mm512_loadu_si512(k0), windows, nb_windows); break;
+		default: mb_exp_any(res, table, mod, _mm512_loadu_si512(k0), windows, nb_windows, N);
+	}
+
+	mb_store(lr, res, N);
+
+	for (l=0; l<MB_LANES; l++) {
+		mpz_clears(one[l], base[l], NULL);
+	}
+	explicit_bzero(table, sizeof(table));
+	explicit_bzero(windows, sizeof(windows));
+	explicit_bzero(res, sizeof(res));
+}
+
+/**
+ * r[i] = b[i]^e[i] mod m[i] for i < count <= MB_LANES, as one
+ * multi-buffer run. The moduli are odd, below 2^MB_MAX_BITS, and
+ * 0 <= b[i] < m[i]. The run takes the size of the largest modulus and
+ * exponent: it is meant for values of the same size (the CRT halves of
+ * RSA decryptions).
+ *
+ * return -1 if the CPU lacks IFMA or the values do not fit: the caller
+ * then uses mpz_powm
+ */
+int mb_powm(mpz_ptr *r, mpz_ptr *b, mpz_ptr *e, mpz_ptr *m, int count) {
+	// vars
+	mpz_ptr lb[MB_LANES], le[MB_LANES], lm[MB_LANES], lr[MB_LANES];
+	mpz_t out[MB_LANES];
+	size_t bits, ebits;
+	int l;
+
+	if (count < 1 || count > MB_LANES || !mb_available()) {
+		return -1;
+	}
+
+	// the unused lanes repeat the first one
+	bits = ebits = 0;
+	for (l=0; l<MB_LANES; l++) {
+		lb[l] = b[l < count ? l : 0];
+		le[l] = e[l < count ? l : 0];
+		lm[l] = m[l < count ? l : 0];
+		if (mpz_even_p(lm[l]) || mpz_sgn(le[l]) < 0) {
+			return -1;
+		}
+		bits  = mpz_sizeinbase(lm[l], 2) > bits ? mpz_sizeinbase(lm[l], 2) : bits;
+		ebits = mpz_sizeinbase(le[l], 2) > ebits ? mpz_sizeinbase(le[l], 2) : ebits;
+	}
+
+	if (bits > MB_MAX_BITS || ebits > MB_MAX_BITS) {
+		return -1;
+	}
+
+	for (l=0; l<MB_LANES; l++) {
+		mpz_init(out[l]);
+		lr[l] = out[l];
+	}
+
+	// a zero exponent still takes one window
+	mb_powm_lanes(lr, lb, le, lm, MB_DIGITS(bits), ebits > 0 ? (ebits + MB_WINDOW-1) / MB_WINDOW : 1);
+
+	// [0, m] to [0, m)
+	for (l=0; l<count; l++) {
+		mpz_mod(r[l], lr[l], lm[l]);
+	}
+
+	for (l=0; l<MB_LANES; l++) {
+		mpz_clear(out[l]);
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * File: rsa_mb.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_MB_
+#define _H_RSA_MB_
+
+#include <gmp.h>
+
+// independent exponentiations run at once, one per 64-bit lane
+#define MB_LANES 		8
+// radix 2^52 digits of the Montgomery representation
+#define MB_DIGIT_BITS 	52
+// largest modulus of a lane (the primes of an 8192-bit key)
+#define MB_MAX_BITS 	4096
+// R = 2^(52 * digits) > 4m, so that the products need no final subtraction
+#define MB_DIGITS(bits) (((bits) + 2 + MB_DIGIT_BITS-1) / MB_DIGIT_BITS)
+#define MB_MAX_DIGITS 	MB_DIGITS(MB_MAX_BITS)
+// bits of exponent per table lookup
+#define MB_WINDOW 		4
+
+int mb_available(void);
+int mb_powm(mpz_ptr *r, mpz_ptr *b, mpz_ptr *e, mpz_ptr *m, int count);
+
+#endif // _H_RSA_MB_
@@ -0,0 +1,459 @@
+/*
+ * File: rsa_mont.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <string.h>
+#include <gmp.h>
+#include <immintrin.h>
+
+#include "rsa_mont.h"
+
+#define MONT_TARGET 	__attribute__((target("bmi2,adx")))
+#define MONT_INLINE 	static inline __attribute__((always_inline)) MONT_TARGET
+#define MONT_TABLE 		(1 << MONT_WINDOW)
+
+/**
+ * Montgomery exponentiation for 1024 and 2048-bit moduli with BMI2/ADX
+ *
+ * Every size gets its own copy of the code, with the loops fully
+ * unrolled: no call, no allocation and no branch on the values within
+ * an exponentiation. The rows of the products are mulx sequences feeding
+ * two carry chains, adcx (CF) for the low halves and adox (OF) for the
+ * high halves, so that the additions of a row do not wait on each other.
+ */
+
+/**
+ * t[0, len) += a[0, len) * d
+ *
+ * return the carry out of t[len-1]
+ */
+MONT_INLINE mp_limb_t mont_row(mp_limb_t *t, const mp_limb_t *a, mp_limb_t d, int len) {
+	mp_limb_t lo, h0, h1;
+
+	__asm__ volatile (
+		"xor %k[h0], %k[h0]\n\t"
+		".set mont_j, 0\n\t"
+		".rept %c[pairs]\n\t"
+		"mulx mont_j(%[a]), %[lo], %[h1]\n\t"
+		"adcx mont_j(%[t]), %[lo]\n\t"
+		"adox %[h0], %[lo]\n\t"
+		"mov %[lo], mont_j(%[t])\n\t"
+		"mulx mont_j+8(%[a]), %[lo], %[h0]\n\t"
+		"adcx mont_j+8(%[t]), %[lo]\n\t"
+		"adox %[h1], %[lo]\n\t"
+		"mov %[lo], mont_j+8(%[t])\n\t"
+		".set mont_j, mont_j+16\n\t"
+		".endr\n\t"
+		".if %c[odd]\n\t"
+		"mulx mont_j(%[a]), %[lo], %[h1]\n\t"
+		"adcx mont_j(%[t]), %[lo]\n\t"
+		"adox %[h0], %[lo]\n\t"
+		"mov %[lo], mont_j(%[t])\n\t"
+		"mov %[h1], %[h0]\n\t"
+		".endif\n\t"
+		// the last high half takes both carries, it cannot overflow
+		"mov $0, %k[lo]\n\t"
+		"adcx %[lo], %[h0]\n\t"
+		"adox %[lo], %[h0]\n\t"
+		: [lo] "=&r" (lo), [h0] "=&r" (h0), [h1] "=&r" (h1)
+		: [t] "r" (t), [a] "r" (a), "d" (d), [pairs] "i" (len / 2), [odd] "i" (len & 1)
+		: "cc", "memory");
+
+	return h0;
+}
+
+/**
+ * r = t / R mod m, in [0, R), for t < R^2 (t is destroyed)
+ * Row i adds q * m to t[i, i+N) so that t[i] becomes 0, and keeps the
+ * carry of the row in t[i]; the carries are added back at the end.
+ * The next q comes from the second limb of the row, taken from a
+ * register: the rows only wait on each other through mulx and imul.
+ *
+ * The sum is below R + m: m is subtracted when it carries, which keeps
+ * r below R (but not always below m). Products of such values are
+ * reduced the same way, only the result of the exponentiation is
+ * brought below m.
+ */
+MONT_INLINE void mont_redc(mp_limb_t *r, mp_limb_t *t, const struct rsa_mont *M, int N) {
+	mp_limb_t *row = t, lo, h0, h1, next, mask;
+	long count = N;
+	unsigned char cy;
+	int j;
+
+	__asm__ volatile (
+		"mov (%[row]), %%rdx\n\t"
+		"1:\n\t"
+		"imul %[k0], %%rdx\n\t"
+		"xor %k[h0], %k[h0]\n\t"
+		"mulx (%[m]), %[lo], %[h1]\n\t"
+		"adcx (%[row]), %[lo]\n\t"
+		"adox %[h0], %[lo]\n\t"
+		"mulx 8(%[m]), %[lo], %[h0]\n\t"
+		"adcx 8(%[row]), %[lo]\n\t"
+		"adox %[h1], %[lo]\n\t"
+		"mov %[lo], 8(%[row])\n\t"
+		"mov %[lo], %[next]\n\t"
+		".set mont_j, 16\n\t"
+		".rept %c[pairs]\n\t"
+		"mulx mont_j(%[m]), %[lo], %[h1]\n\t"
+		"adcx mont_j(%[row]), %[lo]\n\t"
+		"adox %[h0], %[lo]\n\t"
+		"mov %[lo], mont_j(%[row])\n\t"
+		"mulx mont_j+8(%[m]), %[lo], %[h0]\n\t"
+		"adcx mont_j+8(%[row]), %[lo]\n\t"
+		"adox %[h1], %[lo]\n\t"
+		"mov %[lo], mont_j+8(%[row])\n\t"
+		".set mont_j, mont_j+16\n\t"
+		".endr\n\t"
+		"mov $0, %k[lo]\n\t"
+		"adcx %[lo], %[h0]\n\t"
+		"adox %[lo], %[h0]\n\t"
+		"mov %[h0], (%[row])\n\t"
+		"mov %[next], %%rdx\n\t"
+		"lea 8(%[row]), %[row]\n\t"
+		"dec %[count]\n\t"
+		"jnz 1b\n\t"
+		: [row] "+r" (row), [count] "+r" (count),
+		  [lo] "=&r" (lo), [h0] "=&r" (h0), [h1] "=&r" (h1), [next] "=&r" (next)
+		: [m] "r" (M->m), [k0] "r" (M->k0), [pairs] "i" (N/2 - 1)
+		: "rdx", "cc", "memory");
+
+	cy = 0;
+	#pragma GCC unroll 32
+	for (j=0; j<N; j++) {
+		cy = _addcarry_u64(cy, t[N+j], t[j], (unsigned long long *) &r[j]);
+	}
+
+	// minus m & -cy (without branching)
+	mask = 0 - (mp_limb_t) cy;
+	cy 	 = 0;
+	#pragma GCC unroll 32
+	for (j=0; j<N; j++) {
+		cy = _subborrow_u64(cy, r[j], M->m[j] & mask, (unsigned long long *) &r[j]);
+	}
+}
+
+/**
+ * r = r mod m, for r in [0, m] (without branching)
+ */
+MONT_INLINE void mont_final(mp_limb_t *r, const struct rsa_mont *M, int N) {
+	mp_limb_t s[MONT_MAX_LIMBS], mask;
+	unsigned char borrow = 0;
+	int j;
+
+	for (j=0; j<N; j++) {
+		borrow = _subborrow_u64(borrow, r[j], M->m[j], (unsigned long long *) &s[j]);
+	}
+
+	// r - m unless it borrows
+	mask = (mp_limb_t) borrow - 1;
+	for (j=0; j<N; j++) {
+		r[j] = (s[j] & mask) | (r[j] & ~mask);
+	}
+}
+
+/**
+ * r = a * b / R mod m (r may be a or b)
+ */
+MONT_INLINE void mont_mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, const struct rsa_mont *M, int N) {
+	mp_limb_t t[2 * MONT_MAX_LIMBS];
+	int i;
+
+	memset(t, 0, N * sizeof(mp_limb_t));
+	#pragma GCC unroll 32
+	for (i=0; i<N; i++) {
+		t[i+N] = mont_row(t + i, a, b[i], N);
+	}
+
+	mont_redc(r, t, M, N);
+}
+
+/**
+ * r = a^2 / R mod m (r may be a)
+ * The products a_i * a_j, i < j, are computed once and doubled, then
+ * the squares a_i^2 are added.
+ */
+MONT_INLINE void mont_sqr(mp_limb_t *r, const mp_limb_t *a, const struct rsa_mont *M, int N) {
+	mp_limb_t t[2 * MONT_MAX_LIMBS], x0, x1, top, c;
+	unsigned __int128 sq, s;
+	int i;
+
+	memset(t, 0, N * sizeof(mp_limb_t));
+	t[2*N - 1] = 0;
+	#pragma GCC unroll 32
+	for (i=0; i<N-1; i++) {
+		t[i+N] = mont_row(t + 2*i + 1, a + i + 1, a[i], N-1 - i);
+	}
+
+	top = c = 0;
+	for (i=0; i<N; i++) {
+		sq = (unsigned __int128) a[i] * a[i];
+		x0 = t[2*i];
+		x1 = t[2*i + 1];
+
+		s = ((unsigned __int128) ((x0 << 1) | top)) + (mp_limb_t) sq + c;
+		t[2*i] = (mp_limb_t) s;
+		top = x0 >> 63;
+		s = ((unsigned __int128) ((x1 << 1) | top)) + (mp_limb_t) (sq >> 64) + (mp_limb_t) (s >> 64);
+		t[2*i + 1] = (mp_limb_t) s;
+		top = x1 >> 63;
+		c = (mp_limb_t) (s >> 64);
+	}
+
+	mont_redc(r, t, M, N);
+}
+
+/**
+ * r = table[idx], reading every entry (the index is secret)
+ */
+MONT_INLINE void mont_select(mp_limb_t *r, const mp_limb_t *table, unsigned idx, int N) {
+	__m128i acc[MONT_MAX_LIMBS / 2], mask;
+	unsigned k;
+	int j;
+
+	for (j=0; j<N/2; j++) {
+		acc[j] = _mm_setzero_si128();
+	}
+	for (k=0; k<MONT_TABLE; k++) {
+		mask = _mm_set1_epi64x(0 - (long long) (k == idx));
+		#pragma GCC unroll 16
+		for (j=0; j<N/2; j++) {
+			acc[j] = _mm_or_si128(acc[j], _mm_and_si128(mask, _mm_loadu_si128((const __m128i *) &table[k*N + 2*j])));
+		}
+	}
+	for (j=0; j<N/2; j++) {
+		_mm_storeu_si128((__m128i *) &r[2*j], acc[j]);
+	}
+}
+
+/**
+ * MONT_WINDOW bits of e from bit 'pos' (0 past the end)
+ */
+static unsigned mont_window(const mp_limb_t *e, size_t size, mp_bitcnt_t pos) {
+	size_t i = pos / GMP_LIMB_BITS;
+	int shift = pos % GMP_LIMB_BITS;
+	mp_limb_t v;
+
+	if (i >= size) {
+		return 0;
+	}
+
+	v = e[i] >> shift;
+	if (shift + MONT_WINDOW > GMP_LIMB_BITS && i+1 < size) {
+		v |= e[i+1] << (GMP_LIMB_BITS - shift);
+	}
+
+	return v & (MONT_TABLE - 1);
+}
+
+/**
+ * r = b^e mod m, b being 2N limbs
+ * Fixed window: MONT_WINDOW squarings then one product by a table
+ * entry, for every window (the zero ones included).
+ */
+MONT_INLINE void mont_exp(mp_limb_t *r, mp_limb_t *b, const mp_limb_t *e, size_t esize, int nb_windows,
+						  const struct rsa_mont *M, int N) {
+	mp_limb_t table[MONT_TABLE * MONT_MAX_LIMBS], acc[MONT_MAX_LIMBS], sel[MONT_MAX_LIMBS];
+	int k, w, s;
+
+	// table[k] = b^k * R mod m: b / R times R^3, then products
+	memcpy(table, M->one, N * sizeof(mp_limb_t));
+	mont_redc(acc, b, M, N);
+	mont_mul(&table[N], acc, M->rrr, M, N);
+	for (k=2; k<MONT_TABLE; k++) {
+		if (k % 2 == 0) {
+			mont_sqr(&table[k*N], &table[k/2 * N], M, N);
+		} else {
+			mont_mul(&table[k*N], &table[(k-1) * N], &table[N], M, N);
+		}
+	}
+
+	mont_select(acc, table, mont_window(e, esize, (mp_bitcnt_t) (nb_windows-1) * MONT_WINDOW), N);
+	for (w=nb_windows-2; w>=0; w--) {
+		for (s=0; s<MONT_WINDOW; s++) {
+			mont_sqr(acc, acc, M, N);
+		}
+
+		mont_select(sel, table, mont_window(e, esize, (mp_bitcnt_t) w * MONT_WINDOW), N);
+		mont_mul(acc, acc, sel, M, N);
+	}
+
+	// out of the Montgomery form: acc / R mod m, in [0, m] for acc < R
+	memcpy(b, acc, N * sizeof(mp_limb_t));
+	memset(b + N, 0, N * sizeof(mp_limb_t));
+	mont_redc(r, b, M, N);
+	mont_final(r, M, N);
+
+	explicit_bzero(table, sizeof(table));
+	explicit_bzero(acc, sizeof(acc));
+	explicit_bzero(sel, sizeof(sel));
+}
+
+/**
+ * r = b^e mod m, b being 2N limbs, for a public exponent e > 0
+ * Square and multiply from the top bit: 16 squarings and one product
+ * for e = 65537, no table.
+ */
+MONT_INLINE void mont_exp_ui(mp_limb_t *r, mp_limb_t *b, unsigned long e, const struct rsa_mont *M, int N) {
+	mp_limb_t x[MONT_MAX_LIMBS], acc[MONT_MAX_LIMBS];
+	int bit;
+
+	// x = b * R mod m
+	mont_redc(acc, b, M, N);
+	mont_mul(x, acc, M->rrr, M, N);
+
+	memcpy(acc, x, N * sizeof(mp_limb_t));
+	for (bit = 62 - __builtin_clzl(e); bit >= 0; bit--) {
+		mont_sqr(acc, acc, M, N);
+		if ((e >> bit) & 1) {
+			mont_mul(acc, acc, x, M, N);
+		}
+	}
+
+	memcpy(b, acc, N * sizeof(mp_limb_t));
+	memset(b + N, 0, N * sizeof(mp_limb_t));
+	mont_redc(r, b, M, N);
+	mont_final(r, M, N);
+}
+
+#define MONT_EXP_DEFINE(N) 																			\
+MONT_TARGET static void mont_exp_##N(mp_limb_t *r, mp_limb_t *b, const mp_limb_t *e, size_t esize, \
+									 int nb_windows, const struct rsa_mont *M) { 					\
+	mont_exp(r, b, e, esize, nb_windows, M, N); 													\
+} 																									\
+MONT_TARGET static void mont_exp_ui_##N(mp_limb_t *r, mp_limb_t *b, unsigned long e, 				\
+										const struct rsa_mont *M) { 								\
+	mont_exp_ui(r, b, e, M, N); 																	\
+}
+
+MONT_EXP_DEFINE(16)
+MONT_EXP_DEFINE(32)
+
+/**
+ * 1 if this CPU has BMI2 (mulx) and ADX (adcx, adox)
+ */
+int mont_available(void) {
+	return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx");
+}
+
+/**
+ * Compute the constants of m, if a kernel fits it: m odd, of 1024 or
+ * 2048 bits (counted in limbs), and a CPU with BMI2/ADX
+ *
+ * return -1 if no kernel fits m (M->n is then 0)
+ */
+int mont_init(struct rsa_mont *M, mpz_t m) {
+	// vars
+	mp_limb_t inv;
+	mpz_t x;
+	int n, i;
+
+	memset(M, 0, sizeof(*M));
+	n = mpz_size(m);
+	if ((MONT_LIMBS_1024 != n && MONT_LIMBS_2048 != n) || mpz_even_p(m) || !mont_available()) {
+		return -1;
+	}
+
+	mpz_export(M->m, NULL, -1, sizeof(mp_limb_t), 0, 0, m);
+
+	// m^(-1) mod 2^64 by Newton, each step doubles the correct bits
+	inv = M->m[0];
+	for (i=0; i<6; i++) {
+		inv *= 2 - M->m[0] * inv;
+	}
+	M->k0 = 0 - inv;
+
+	// R mod m and R^3 mod m
+	mpz_init(x);
+	mpz_setbit(x, (mp_bitcnt_t) n * GMP_LIMB_BITS);
+	mpz_mod(x, x, m);
+	mpz_export(M->one, NULL, -1, sizeof(mp_limb_t), 0, 0, x);
+
+	mpz_set_ui(x, 0);
+	mpz_setbit(x, (mp_bitcnt_t) 3 * n * GMP_LIMB_BITS);
+	mpz_mod(x, x, m);
+	mpz_export(M->rrr, NULL, -1, sizeof(mp_limb_t), 0, 0, x);
+	mpz_clear(x);
+
+	M->n = n;
+	return 0;
+}
+
+/**
+ * Wipe the constants (m is a prime of the private key)
+ */
+void mont_clear(struct rsa_mont *M) {
+	explicit_bzero(M, sizeof(*M));
+}
+
+/**
+ * r = b^e mod m, with 0 <= b < R^2 (any ciphertext below n = p * q
+ * for the primes of a key), and e >= 0
+ *
+ * return -1 if no kernel fits: the caller then uses mpz_powm
+ */
+int mont_powm(mpz_t r, mpz_t b, mpz_t e, struct rsa_mont *M) {
+	// vars
+	mp_limb_t base[2 * MONT_MAX_LIMBS], res[MONT_MAX_LIMBS];
+	mp_limb_t *rp;
+	size_t bsize;
+	int n = M->n, nb_windows;
+
+	bsize = mpz_size(b);
+	if (0 == n || mpz_sgn(b) < 0 || mpz_sgn(e) < 0 || bsize > (size_t) 2*n) {
+		return -1;
+	}
+
+	memset(base, 0, sizeof(base));
+	memcpy(base, mpz_limbs_read(b), bsize * sizeof(mp_limb_t));
+	nb_windows = (mpz_sizeinbase(e, 2) + MONT_WINDOW-1) / MONT_WINDOW;
+
+	// r may be b or e: the result is copied at the end
+	if (MONT_LIMBS_1024 == n) {
+		mont_exp_16(res, base, mpz_limbs_read(e), mpz_size(e), nb_windows, M);
+	} else {
+		mont_exp_32(res, base, mpz_limbs_read(e), mpz_size(e), nb_windows, M);
+	}
+
+	rp = mpz_limbs_write(r, n);
+	memcpy(rp, res, n * sizeof(mp_limb_t));
+	mpz_limbs_finish(r, n);
+
+	explicit_bzero(base, sizeof(base));
+	explicit_bzero(res, sizeof(res));
+	return 0;
+}
+
+/**
+ * r = b^e mod m for a public exponent 0 < e < 2^64 (3, 17, 65537...),
+ * with 0 <= b < R^2: a plain square and multiply, e is not secret
+ *
+ * return -1 if no kernel fits: the caller then uses mpz_powm
+ */
+int mont_powm_ui(mpz_t r, mpz_t b, unsigned long e, struct rsa_mont *M) {
+	// vars
+	mp_limb_t base[2 * MONT_MAX_LIMBS], res[MONT_MAX_LIMBS];
+	mp_limb_t *rp;
+	size_t bsize;
+	int n = M->n;
+
+	bsize = mpz_size(b);
+	if (0 == n || 0 == e || mpz_sgn(b) < 0 || bsize > (size_t) 2*n) {
+		return -1;
+	}
+
+	memset(base, 0, sizeof(base));
+	memcpy(base, mpz_limbs_read(b), bsize * sizeof(mp_limb_t));
+
+	if (MONT_LIMBS_1024 == n) {
+		mont_exp_ui_16(res, base, e, M);
+	} else {
+		mont_exp_ui_32(res, base, e, M);
+	}
+
+	rp = mpz_limbs_write(r, n);
+	memcpy(rp, res, n * sizeof(mp_limb_t));
+	mpz_limbs_finish(r, n);
+	return 0;
+}
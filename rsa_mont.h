@@ -0,0 +1,37 @@
+/*
+ * File: rsa_mont.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_MONT_
+#define _H_RSA_MONT_
+
+#include <gmp.h>
+
+// moduli of the fixed-size kernels: the primes of a 2048-bit key, and
+// a 2048-bit modulus (keys without the quintuple)
+#define MONT_LIMBS_1024 	16
+#define MONT_LIMBS_2048 	32
+#define MONT_MAX_LIMBS 		MONT_LIMBS_2048
+// bits of exponent per table lookup
+#define MONT_WINDOW 		5
+
+/**
+ * Constants of a modulus m, computed once per key
+ * n is 0 when no kernel fits m: mont_powm then returns -1
+ */
+struct rsa_mont {
+	int n; 							// limbs of m
+	mp_limb_t k0; 					// -m^(-1) mod 2^64
+	mp_limb_t m[MONT_MAX_LIMBS];
+	mp_limb_t one[MONT_MAX_LIMBS]; 	// R mod m, R = 2^(64n)
+	mp_limb_t rrr[MONT_MAX_LIMBS]; 	// R^3 mod m
+};
+
+int mont_available(void);
+int mont_init(struct rsa_mont *M, mpz_t m);
+void mont_clear(struct rsa_mont *M);
+int mont_powm(mpz_t r, mpz_t b, mpz_t e, struct rsa_mont *M);
+int mont_powm_ui(mpz_t r, mpz_t b, unsigned long e, struct rsa_mont *M);
+
+#endif // _H_RSA_MONT_
@@ -0,0 +1,208 @@
+/*
+ * File: rsa_pool.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "rsa_error.h"
+#include "rsa_pool.h"
+
+/**
+ * Fixed set of worker threads. The thread calling pool_run takes part
+ * in the work as worker 0, so nb_threads - 1 threads are created.
+ */
+struct rsa_pool {
+	int nb_threads;
+	pthread_t *threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long generation; 	// incremented on each pool_run
+	int running; 				// workers still busy with the current run
+	int stop;
+
+	// current run
+	pool_job job;
+	void *arg;
+	int nb_jobs;
+	int next; 					// next job index, taken atomically
+};
+
+// workers of the runs in progress, over every pool
+static int pool_running;
+// the thread is one of them
+static __thread int pool_inside;
+
+struct worker_arg {
+	struct rsa_pool *pool;
+	int worker;
+};
+
+/**
+ * Take job indexes until every job of the current run is taken
+ */
+static void pool_work(struct rsa_pool *pool, int worker) {
+	int i, inside = pool_inside;
+
+	pool_inside = 1;
+	while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->nb_jobs) {
+		pool->job(pool->arg, i, worker);
+	}
+	pool_inside = inside;
+}
+
+static void * pool_thread(void *data) {
+	struct worker_arg *wa = data;
+	struct rsa_pool *pool = wa->pool;
+	unsigned long seen = 0;
+	int worker = wa->worker;
+
+	free(wa);
+	for (;;) {
+		// waiting for a new run
+		pthread_mutex_lock(&pool->lock);
+		while (pool->generation == seen && !pool->stop) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, worker);
+
+		// last one out wakes pool_run up
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Create a pool of nb_threads workers (at least 1)
+ *
+ * return NULL if an error occured
+ */
+struct rsa_pool * pool_create(int nb_threads) {
+	struct rsa_pool *pool;
+	struct worker_arg *wa;
+	int i;
+
+	if (nb_threads < 1) {
+		nb_threads = 1;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (NULL == pool) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return NULL;
+	}
+
+	pool->threads = calloc(nb_threads, sizeof(*pool->threads));
+	if (NULL == pool->threads) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		free(pool);
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	// worker 0 is the caller of pool_run
+	pool->nb_threads = 1;
+	for (i=1; i<nb_threads; i++) {
+		wa = malloc(sizeof(*wa));
+		if (NULL == wa) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+			pool_destroy(pool);
+			return NULL;
+		}
+		wa->pool   = pool;
+		wa->worker = i;
+
+		if (pthread_create(&pool->threads[i], NULL, pool_thread, wa) != 0) {
+			rsa_error(RSA_ETHREAD, "Unable to create a worker thread.");
+			free(wa);
+			pool_destroy(pool);
+			return NULL;
+		}
+		pool->nb_threads++;
+	}
+
+	return pool;
+}
+
+/**
+ * Run job(arg, i, worker) for every i in [0, nb_jobs) and wait for all
+ * of them to finish
+ */
+void pool_run(struct rsa_pool *pool, int nb_jobs, pool_job job, void *arg) {
+	__atomic_fetch_add(&pool_running, pool->nb_threads, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->job 	  = job;
+	pool->arg 	  = arg;
+	pool->nb_jobs = nb_jobs;
+	pool->next 	  = 0;
+	pool->running = pool->nb_threads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	__atomic_fetch_sub(&pool_running, pool->nb_threads, __ATOMIC_RELAXED);
+}
+
+/**
+ * Number of workers of the pool, including the caller of pool_run
+ */
+int pool_size(struct rsa_pool *pool) {
+	return pool->nb_threads;
+}
+
+/**
+ * Number of workers busy with a pool_run, over every pool, the calling
+ * thread excluded
+ */
+int pool_busy(void) {
+	return __atomic_load_n(&pool_running, __ATOMIC_RELAXED) - pool_inside;
+}
+
+/**
+ * Stop the workers and free the pool
+ */
+void pool_destroy(struct rsa_pool *pool) {
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i=1; i<pool->nb_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,23 @@
+/*
+ * File: rsa_pool.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_POOL_
+#define _H_RSA_POOL_
+
+/**
+ * A job is called once per index i in [0, nb_jobs), worker is the
+ * index of the thread running it, in [0, nb_threads)
+ */
+typedef void (*pool_job)(void *arg, int i, int worker);
+
+struct rsa_pool;
+
+struct rsa_pool * pool_create(int nb_threads);
+void pool_run(struct rsa_pool *pool, int nb_jobs, pool_job job, void *arg);
+int pool_size(struct rsa_pool *pool);
+int pool_busy(void);
+void pool_destroy(struct rsa_pool *pool);
+
+#endif // _H_RSA_POOL_
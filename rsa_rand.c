@@ -0,0 +1,184 @@
+/*
+ * File: rsa_rand.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <gmp.h>
+#include <sys/random.h>
+
+#include "rsa_error.h"
+#include "chacha20.h"
+#include "rsa_rand.h"
+
+/**
+ * Per-thread generator: ChaCha20 keystream produced RAND_BUFFER octets
+ * at a time. The first 32 octets of each refill become the next key
+ * and every octet handed out is wiped from the buffer, so a later
+ * compromise of the state does not reveal earlier output.
+ */
+struct drbg {
+	struct chacha20 cipher;
+	unsigned char buffer[RAND_BUFFER];
+	size_t pos; 				// next unused octet of buffer
+	unsigned long generation; 	// fork generation when seeded
+	int seeded;
+};
+
+static __thread struct drbg drbg;
+
+// incremented in the child after each fork, so that it reseeds
+static unsigned long fork_generation;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void rand_atfork_child(void) {
+	fork_generation++;
+}
+
+static void rand_register_atfork(void) {
+	pthread_atfork(NULL, NULL, rand_atfork_child);
+}
+
+/**
+ * Read len octets of entropy from the kernel
+ *
+ * return -1 if no entropy source is available
+ */
+static int rand_entropy(unsigned char *out, size_t len) {
+	FILE *fp_urandom;
+	ssize_t got;
+
+	while (len > 0) {
+		got = getrandom(out, len, 0);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+
+		// kernels without getrandom
+		if (got < 0) {
+			fp_urandom = fopen("/dev/urandom", "r");
+			if (NULL == fp_urandom || fread(out, 1, len, fp_urandom) != len) {
+				rsa_error(RSA_ERANDOM, "Unable to seed the random generator.");
+				if (NULL != fp_urandom) {
+					fclose(fp_urandom);
+				}
+				return -1;
+			}
+			fclose(fp_urandom);
+			return 0;
+		}
+
+		out += got;
+		len -= got;
+	}
+
+	return 0;
+}
+
+static int drbg_seed(struct drbg *g) {
+	unsigned char key[CHACHA20_KEY_SIZE], nonce[CHACHA20_NONCE_SIZE];
+
+	pthread_once(&atfork_once, rand_register_atfork);
+
+	if (rand_entropy(key, sizeof(key)) == -1) {
+		return -1;
+	}
+	memset(nonce, 0, sizeof(nonce));
+	chacha20_init(&g->cipher, key, nonce, 0);
+	memset(key, 0, sizeof(key));
+
+	g->pos 		  = RAND_BUFFER;
+	g->generation = fork_generation;
+	g->seeded 	  = 1;
+	return 0;
+}
+
+static void drbg_refill(struct drbg *g) {
+	unsigned char nonce[CHACHA20_NONCE_SIZE];
+
+	chacha20_blocks(&g->cipher, g->buffer, RAND_BUFFER / CHACHA20_BLOCK_SIZE);
+
+	// fast key erasure: the first octets are the next key
+	memset(nonce, 0, sizeof(nonce));
+	chacha20_init(&g->cipher, g->buffer, nonce, 0);
+	memset(g->buffer, 0, CHACHA20_KEY_SIZE);
+	g->pos = CHACHA20_KEY_SIZE;
+}
+
+/**
+ * Fill out with len random octets from the calling thread's generator
+ *
+ * return -1 if the generator could not be seeded
+ */
+int rand_bytes(unsigned char *out, size_t len) {
+	struct drbg *g = &drbg;
+	size_t n;
+
+	if (!g->seeded || g->generation != fork_generation) {
+		if (drbg_seed(g) == -1) {
+			return -1;
+		}
+	}
+
+	while (len > 0) {
+		if (g->pos == RAND_BUFFER) {
+			drbg_refill(g);
+		}
+
+		n = RAND_BUFFER - g->pos < len ? RAND_BUFFER - g->pos : len;
+		memcpy(out, g->buffer + g->pos, n);
+		memset(g->buffer + g->pos, 0, n);
+
+		g->pos += n;
+		out += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Fill out with len random nonzero octets (uniform over 1..255)
+ *
+ * return -1 if the generator could not be seeded
+ */
+int rand_nonzero_bytes(unsigned char *out, size_t len) {
+	size_t i;
+
+	if (rand_bytes(out, len) == -1) {
+		return -1;
+	}
+	for (i=0; i<len; i++) {
+		while (0 == out[i]) {
+			rand_bytes(&out[i], 1);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Seed a GMP random state with 256 bits from the calling thread's
+ * generator
+ *
+ * return -1 if the generator could not be seeded
+ */
+int rand_seed_gmp(gmp_randstate_t rs) {
+	unsigned char octets[32];
+	mpz_t seed;
+
+	if (rand_bytes(octets, sizeof(octets)) == -1) {
+		return -1;
+	}
+	mpz_init(seed);
+	mpz_import(seed, sizeof(octets), 1, 1, 1, 0, octets);
+	gmp_randseed(rs, seed);
+
+	mpz_clear(seed);
+	memset(octets, 0, sizeof(octets));
+	return 0;
+}
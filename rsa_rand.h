@@ -0,0 +1,19 @@
+/*
+ * File: rsa_rand.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_RAND_
+#define _H_RSA_RAND_
+
+#include <stddef.h>
+#include <gmp.h>
+
+// keystream generated per refill of a thread's buffer
+#define RAND_BUFFER 	4096
+
+int rand_bytes(unsigned char *out, size_t len);
+int rand_nonzero_bytes(unsigned char *out, size_t len);
+int rand_seed_gmp(gmp_randstate_t rs);
+
+#endif // _H_RSA_RAND_
@@ -0,0 +1,269 @@
+/*
+ * File: rsa_ring.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "rsa_error.h"
+#include "rsa_ring.h"
+
+/**
+ * Sleep while *word is val (shared between processes), one second at
+ * most so that the callers see a stop flag set meanwhile
+ */
+static void futex_wait(uint32_t *word, uint32_t val) {
+	struct timespec timeout = { 1, 0 };
+
+	syscall(SYS_futex, word, FUTEX_WAIT, val, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t *word) {
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/**
+ * Wait until *word is no longer val, telling the other side through
+ * *waiting that a wake up is needed
+ * The flag is raised before the last check, and both sides use
+ * sequentially consistent accesses, so a change cannot go unnoticed
+ */
+static void ring_sleep(uint32_t *word, uint32_t val, uint32_t *waiting) {
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == val) {
+		futex_wait(word, val);
+	}
+	__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Store val into *word and wake the other side if it sleeps on it
+ */
+static void ring_signal(uint32_t *word, uint32_t val, uint32_t *waiting) {
+	__atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+		futex_wake(word);
+	}
+}
+
+/**
+ * Map the segment 'name' of nb_slots slots of slot_size octets
+ *
+ * return NULL if an error occured
+ */
+static struct rsa_ring * ring_map(const char *name, int fd, uint32_t nb_slots, uint32_t slot_size) {
+	struct rsa_ring *ring;
+	size_t map_len;
+	void *map;
+
+	map_len = sizeof(struct ring_header) + (size_t) nb_slots * slot_size;
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == map) {
+		rsa_error(RSA_EIO, "Unable to map the ring '%s'.", name);
+		return NULL;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (NULL == ring) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		munmap(map, map_len);
+		return NULL;
+	}
+
+	ring->header 	= map;
+	ring->slots 	= (unsigned char *) map + sizeof(struct ring_header);
+	ring->map_len 	= map_len;
+	ring->nb_slots 	= nb_slots;
+	ring->slot_size = slot_size;
+	return ring;
+}
+
+/**
+ * Create the shared segment 'name' (a POSIX shared memory name, as
+ * "/rsa") with nb_slots slots (rounded up to a power of 2) for a
+ * modulus of k octets
+ *
+ * return NULL if an error occured
+ */
+struct rsa_ring * ring_create(const char *name, uint32_t nb_slots, uint32_t k) {
+	struct rsa_ring *ring;
+	struct ring_header *header;
+	uint32_t slots, slot_size;
+	size_t map_len;
+	int fd;
+
+	for (slots=1; slots<nb_slots; slots*=2);
+	slot_size = (sizeof(struct ring_slot) + k + 63) & ~63U;
+	map_len   = sizeof(struct ring_header) + (size_t) slots * slot_size;
+
+	shm_unlink(name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0 || ftruncate(fd, map_len) != 0) {
+		rsa_error(RSA_EIO, "Unable to create the ring '%s'.", name);
+		if (fd >= 0) {
+			close(fd);
+			shm_unlink(name);
+		}
+		return NULL;
+	}
+
+	ring = ring_map(name, fd, slots, slot_size);
+	if (NULL == ring || NULL == (ring->name = strdup(name))) {
+		ring_detach(ring);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	// the magic last: a producer attaching sees a complete header
+	header = ring->header;
+	header->version   = RING_VERSION;
+	header->k 		  = k;
+	header->nb_slots  = slots;
+	header->slot_size = slot_size;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, RING_MAGIC, 4);
+
+	return ring;
+}
+
+/**
+ * Map the existing segment 'name' (producer side)
+ *
+ * return NULL if an error occured
+ */
+struct rsa_ring * ring_attach(const char *name) {
+	struct ring_header header;
+	struct stat st;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+		|| memcmp(header.magic, RING_MAGIC, 4) != 0 || header.version != RING_VERSION) {
+		rsa_error(RSA_EIO, "No ring named '%s'.", name);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	// a layout the segment holds, as ring_create makes it
+	if (0 == header.nb_slots || (header.nb_slots & (header.nb_slots - 1)) != 0
+		|| header.slot_size < sizeof(struct ring_slot) + header.k
+		|| fstat(fd, &st) != 0
+		|| (size_t) st.st_size < sizeof(header) + (size_t) header.nb_slots * header.slot_size) {
+		rsa_error(RSA_EFORMAT, "Malformed ring '%s'.", name);
+		close(fd);
+		return NULL;
+	}
+
+	return ring_map(name, fd, header.nb_slots, header.slot_size);
+}
+
+/**
+ * Unmap the segment, and remove it on the side that created it (the
+ * producer is woken up if it waits)
+ */
+void ring_detach(struct rsa_ring *ring) {
+	if (NULL == ring) {
+		return;
+	}
+
+	if (NULL != ring->name) {
+		ring_signal(&ring->header->stop, 1, &ring->header->producer_waiting);
+		futex_wake(&ring->header->tail);
+		shm_unlink(ring->name);
+		free(ring->name);
+	}
+
+	munmap(ring->header, ring->map_len);
+	free(ring);
+}
+
+struct ring_slot * ring_slot(struct rsa_ring *ring, uint32_t seq) {
+	return (struct ring_slot *) (ring->slots + (size_t) (seq & (ring->nb_slots - 1)) * ring->slot_size);
+}
+
+/**
+ * Wait until the slot seq is free: the producer fills the slots in
+ * sequence, from header->head, and hands them over with ring_publish
+ *
+ * return the slot, NULL if the server left
+ */
+struct ring_slot * ring_reserve(struct rsa_ring *ring, uint32_t seq) {
+	struct ring_header *header = ring->header;
+	uint32_t tail;
+
+	while (seq - (tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE)) >= ring->nb_slots) {
+		if (__atomic_load_n(&header->stop, __ATOMIC_RELAXED)) {
+			return NULL;
+		}
+		ring_sleep(&header->tail, tail, &header->producer_waiting);
+	}
+
+	return ring_slot(ring, seq);
+}
+
+/**
+ * Hand the filled slots up to 'head' (excluded) to the server
+ */
+void ring_publish(struct rsa_ring *ring, uint32_t head) {
+	ring_signal(&ring->header->head, head, &ring->header->server_waiting);
+}
+
+/**
+ * Wait until the slot seq is completed
+ *
+ * return -1 if the server left first
+ */
+int ring_wait(struct rsa_ring *ring, uint32_t seq) {
+	struct ring_header *header = ring->header;
+	uint32_t tail;
+
+	while ((int32_t) ((tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE)) - seq) <= 0) {
+		if (__atomic_load_n(&header->stop, __ATOMIC_RELAXED)) {
+			return -1;
+		}
+		ring_sleep(&header->tail, tail, &header->producer_waiting);
+	}
+
+	return 0;
+}
+
+/**
+ * Wait for submitted slots past 'tail' (server side), *head is set to
+ * the end of the submitted slots
+ *
+ * return -1 if *stop was set meanwhile (by a signal)
+ */
+int ring_wait_work(struct rsa_ring *ring, uint32_t tail, uint32_t *head, volatile sig_atomic_t *stop) {
+	struct ring_header *header = ring->header;
+
+	while ((*head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE)) == tail) {
+		if (*stop) {
+			return -1;
+		}
+		ring_sleep(&header->head, tail, &header->server_waiting);
+	}
+
+	return 0;
+}
+
+/**
+ * Mark the slots before 'tail' completed (server side)
+ */
+void ring_complete(struct rsa_ring *ring, uint32_t tail) {
+	ring_signal(&ring->header->tail, tail, &ring->header->producer_waiting);
+}
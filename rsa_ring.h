@@ -0,0 +1,86 @@
+/*
+ * File: rsa_ring.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_RING_
+#define _H_RSA_RING_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+
+#define RING_MAGIC 		"QRSR"
+#define RING_VERSION 	1
+
+// operation of a slot (the values of the socket protocol)
+#define RING_ENCRYPT 	1 	// at most k-11 octets -> k octets
+#define RING_DECRYPT 	2 	// k octets -> plaintext
+
+// status of a completed slot
+#define RING_OK 		0
+#define RING_EINVAL 	1 	// unknown op or bad length
+#define RING_EFAIL 		2 	// the RSA operation failed (bad padding)
+
+/**
+ * Start of the shared segment, followed by nb_slots slots of slot_size
+ * octets. Sequence numbers only grow, slot seq is seq % nb_slots:
+ *  [tail, head) submitted by the producer, being transformed in place
+ *  [head, tail + nb_slots) free for the producer
+ * head and tail are futex words; a side only issues a wake up when the
+ * other one has announced it sleeps (server_waiting, producer_waiting)
+ */
+struct ring_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t k; 					// length in octets of n
+	uint32_t nb_slots; 				// power of 2
+	uint32_t slot_size;
+	uint32_t stop; 					// set when the server leaves
+
+	uint32_t head __attribute__((aligned(64))); 	// written by the producer
+	uint32_t server_waiting;
+	uint32_t tail __attribute__((aligned(64))); 	// written by the server
+	uint32_t producer_waiting;
+} __attribute__((aligned(64)));
+
+/**
+ * One block, transformed in place: data holds the input, then the
+ * output (len octets)
+ */
+struct ring_slot {
+	uint32_t op;
+	uint32_t len;
+	uint32_t status;
+	uint32_t reserved;
+	unsigned char data[];
+};
+
+/**
+ * A mapping of the segment, with its own copy of the layout: the other
+ * side may write anything into the header
+ */
+struct rsa_ring {
+	struct ring_header *header;
+	unsigned char *slots;
+	size_t map_len;
+	uint32_t nb_slots, slot_size;
+	char *name; 					// set when this side created it
+};
+
+struct rsa_ring * ring_create(const char *name, uint32_t nb_slots, uint32_t k);
+struct rsa_ring * ring_attach(const char *name);
+void ring_detach(struct rsa_ring *ring);
+
+struct ring_slot * ring_slot(struct rsa_ring *ring, uint32_t seq);
+
+// producer side (one producer per ring)
+struct ring_slot * ring_reserve(struct rsa_ring *ring, uint32_t seq);
+void ring_publish(struct rsa_ring *ring, uint32_t head);
+int ring_wait(struct rsa_ring *ring, uint32_t seq);
+
+// server side
+int ring_wait_work(struct rsa_ring *ring, uint32_t tail, uint32_t *head, volatile sig_atomic_t *stop);
+void ring_complete(struct rsa_ring *ring, uint32_t tail);
+
+#endif // _H_RSA_RING_
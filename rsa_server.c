@@ -0,0 +1,696 @@
+/*
+ * File: rsa_server.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_keys.h"
+#include "rsa_pool.h"
+#include "rsa_ring.h"
+#include "rsa_server.h"
+
+// octets read from a client per call
+#define SERVE_IN_BUFFER 	65536
+#define SERVE_MAX_PAYLOAD 	(RSA_MAX_BITS / 8)
+// responses owed to a client past which its requests wait (neither read
+// nor parsed) until it reads them: one batch more at most
+#define SERVE_OUT_LIMIT 	(1 << 20)
+
+struct serve_client {
+	int fd;
+	int eof; 					// the peer will send nothing more
+	unsigned char *in; 			// SERVE_IN_BUFFER octets
+	size_t in_len;
+	unsigned char *out; 		// responses not written yet
+	size_t out_pos, out_len, out_size;
+};
+
+struct serve_request {
+	struct serve_client *client;
+	struct serve_frame frame;
+	unsigned char in[SERVE_MAX_PAYLOAD];
+	unsigned char out[SERVE_MAX_PAYLOAD];
+	uint32_t out_len;
+	uint32_t status;
+	double received; 			// microseconds
+};
+
+struct serve_hist {
+	uint64_t count[SERVE_HIST_BUCKETS];
+	uint64_t total;
+	double sum_us, max_us;
+};
+
+/**
+ * Keys, contexts (one pair per worker) and the batch being served
+ */
+struct server {
+	struct rsa_pool *pool;
+	mpz_t n, e;
+	struct rsa_priv K;
+	int loaded; 				// keys loaded: 1 public, 2 both
+	struct rsa_ctx *pub, *priv;
+	int nb_ctx;
+
+	struct serve_client *clients[SERVE_MAX_CLIENTS];
+	int nb_clients;
+
+	struct serve_request *batch;
+	int nb_requests;
+
+	struct serve_hist hist[2]; 	// encrypt, decrypt
+
+	struct rsa_ring *ring; 		// --serve-ring
+	uint32_t ring_tail; 		// first slot of the batch
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+	(void) sig;
+	serve_stop = 1;
+}
+
+static double now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Encrypt or decrypt the len octets of 'in' into 'out' (k octets at
+ * least, may be 'in') with the contexts of the worker
+ *
+ * return the status of the response
+ */
+static uint32_t serve_op(struct server *server, int worker, uint32_t op, unsigned char *in, uint32_t len,
+						 unsigned char *out, uint32_t *out_len) {
+	struct rsa_ctx *ctx;
+	int rLen;
+
+	*out_len = 0;
+	switch (op) {
+		case SERVE_ENCRYPT:
+			ctx = &server->pub[worker];
+			if (len > (uint32_t) (ctx->k - 11)) {
+				return SERVE_EINVAL;
+			}
+			rLen = rsa_ctx_encrypt_into(ctx, out, ctx->k, in, len);
+			break;
+
+		case SERVE_DECRYPT:
+			ctx = &server->priv[worker];
+			if (len != (uint32_t) ctx->k) {
+				return SERVE_EINVAL;
+			}
+			rLen = rsa_ctx_decrypt_into(ctx, out, ctx->k, in, len);
+			break;
+
+		default:
+			return SERVE_EINVAL;
+	}
+
+	if (-1 == rLen) {
+		return SERVE_EFAIL;
+	}
+
+	*out_len = rLen;
+	return SERVE_OK;
+}
+
+/**
+ * Run one request of the batch (run by the workers)
+ */
+static void serve_job(void *arg, int i, int worker) {
+	struct server *server = arg;
+	struct serve_request *req = &server->batch[i];
+
+	if (SERVE_STATS == req->frame.op) {
+		req->status  = SERVE_OK;
+		req->out_len = 0;
+		return;
+	}
+
+	req->status = serve_op(server, worker, req->frame.op, req->in, req->frame.len, req->out, &req->out_len);
+}
+
+/**
+ * Transform the slot tail + i of the ring in place (run by the workers)
+ */
+static void ring_job(void *arg, int i, int worker) {
+	struct server *server = arg;
+	struct ring_slot *slot = ring_slot(server->ring, server->ring_tail + i);
+	uint32_t op, len;
+
+	// read once: the producer may rewrite the slot meanwhile, and
+	// serve_op bounds len to the k octets of data
+	op  = __atomic_load_n(&slot->op, __ATOMIC_RELAXED);
+	len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+
+	slot->status = serve_op(server, worker, op, slot->data, len, slot->data, &len);
+	slot->len 	 = len;
+}
+
+/**
+ * Queue len octets for the client
+ *
+ * return -1 if an error occured
+ */
+static int client_append(struct serve_client *client, const void *data, size_t len) {
+	unsigned char *out;
+	size_t size;
+
+	// dropping what was already written
+	if (client->out_pos > 0) {
+		memmove(client->out, client->out + client->out_pos, client->out_len - client->out_pos);
+		client->out_len -= client->out_pos;
+		client->out_pos  = 0;
+	}
+
+	if (client->out_len + len > client->out_size) {
+		size = client->out_size ? client->out_size : 4096;
+		while (size < client->out_len + len) {
+			size *= 2;
+		}
+
+		out = realloc(client->out, size);
+		if (NULL == out) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+			return -1;
+		}
+		client->out 	 = out;
+		client->out_size = size;
+	}
+
+	memcpy(client->out + client->out_len, data, len);
+	client->out_len += len;
+	return 0;
+}
+
+/**
+ * Whether the client owes reading SERVE_OUT_LIMIT octets of responses
+ */
+static int client_full(struct serve_client *client) {
+	return client->out_len - client->out_pos >= SERVE_OUT_LIMIT;
+}
+
+static void client_close(struct server *server, int i) {
+	struct serve_client *client = server->clients[i];
+	int j;
+
+	// requests of the current batch are not answered
+	for (j=0; j<server->nb_requests; j++) {
+		if (server->batch[j].client == client) {
+			server->batch[j].client = NULL;
+		}
+	}
+
+	close(client->fd);
+	free(client->in);
+	free(client->out);
+	free(client);
+
+	server->clients[i] = server->clients[--server->nb_clients];
+}
+
+static void hist_add(struct serve_hist *hist, double us) {
+	int b;
+
+	for (b=0; b<SERVE_HIST_BUCKETS-1 && us >= (double) (2UL << b); b++);
+	hist->count[b]++;
+	hist->total++;
+	hist->sum_us += us;
+	if (us > hist->max_us) {
+		hist->max_us = us;
+	}
+}
+
+/**
+ * Upper bound, in microseconds, of the bucket holding the p-th percentile
+ */
+static unsigned long hist_percentile(struct serve_hist *hist, double p) {
+	uint64_t seen = 0;
+	int b;
+
+	if (0 == hist->total) {
+		return 0;
+	}
+
+	for (b=0; b<SERVE_HIST_BUCKETS; b++) {
+		seen += hist->count[b];
+		if (seen > 0 && seen >= p / 100.0 * hist->total) {
+			break;
+		}
+	}
+
+	return 2UL << (b < SERVE_HIST_BUCKETS ? b : SERVE_HIST_BUCKETS-1);
+}
+
+/**
+ * Write the histograms as text into buf (at most size octets)
+ *
+ * return the length of the text
+ */
+static int hist_print(struct server *server, char *buf, size_t size) {
+	static const char *names[] = { "encrypt", "decrypt" };
+	struct serve_hist *hist;
+	size_t len = 0;
+	int op, b;
+
+	for (op=0; op<2; op++) {
+		hist = &server->hist[op];
+		len += snprintf(buf + len, size - len,
+			"%s: %" PRIu64 " requests, mean %.1f us, p50 < %lu us, p99 < %lu us, max %.1f us\n",
+			names[op], hist->total, hist->total ? hist->sum_us / hist->total : 0.0,
+			hist_percentile(hist, 50), hist_percentile(hist, 99), hist->max_us);
+
+		for (b=0; b<SERVE_HIST_BUCKETS && len < size; b++) {
+			if (hist->count[b] > 0) {
+				len += snprintf(buf + len, size - len, "  [%lu, %lu) us: %" PRIu64 "\n",
+					b ? 1UL << b : 0, 2UL << b, hist->count[b]);
+			}
+		}
+
+		if (len >= size) {
+			return size - 1;
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Move the complete frames of a client into the batch, while it has room
+ *
+ * return -1 on a protocol error
+ */
+static int client_parse(struct server *server, struct serve_client *client) {
+	struct serve_request *req;
+	struct serve_frame frame;
+	size_t pos = 0;
+
+	while (server->nb_requests < SERVE_BATCH && client->in_len - pos >= sizeof(frame)) {
+		memcpy(&frame, client->in + pos, sizeof(frame));
+		if (frame.len > SERVE_MAX_PAYLOAD) {
+			return -1;
+		}
+		if (client->in_len - pos < sizeof(frame) + frame.len) {
+			break;
+		}
+
+		req = &server->batch[server->nb_requests++];
+		req->client   = client;
+		req->frame 	  = frame;
+		req->received = now_us();
+		memcpy(req->in, client->in + pos + sizeof(frame), frame.len);
+		pos += sizeof(frame) + frame.len;
+	}
+
+	memmove(client->in, client->in + pos, client->in_len - pos);
+	client->in_len -= pos;
+	return 0;
+}
+
+/**
+ * Whether the client has a complete frame waiting in its buffer
+ */
+static int client_ready(struct serve_client *client) {
+	struct serve_frame frame;
+
+	if (client->in_len < sizeof(frame)) {
+		return 0;
+	}
+	memcpy(&frame, client->in, sizeof(frame));
+	return client->in_len >= sizeof(frame) + frame.len;
+}
+
+/**
+ * Run the batch on the pool and queue the responses
+ */
+static void serve_batch(struct server *server) {
+	struct serve_request *req;
+	struct serve_frame frame;
+	char stats[4096];
+	double done;
+	int i;
+
+	pool_run(server->pool, server->nb_requests, serve_job, server);
+
+	done = now_us();
+	for (i=0; i<server->nb_requests; i++) {
+		req = &server->batch[i];
+		if (SERVE_OK == req->status && (SERVE_ENCRYPT == req->frame.op || SERVE_DECRYPT == req->frame.op)) {
+			hist_add(&server->hist[req->frame.op - SERVE_ENCRYPT], done - req->received);
+		}
+
+		if (NULL == req->client) {
+			continue;
+		}
+
+		if (SERVE_STATS == req->frame.op) {
+			req->out_len = hist_print(server, stats, sizeof(stats));
+		}
+
+		frame.op  = req->status;
+		frame.id  = req->frame.id;
+		frame.len = req->out_len;
+		if (-1 == client_append(req->client, &frame, sizeof(frame))
+			|| -1 == client_append(req->client, SERVE_STATS == req->frame.op ? (unsigned char *) stats : req->out, req->out_len)) {
+			req->client->eof = 1;
+		}
+	}
+
+	server->nb_requests = 0;
+}
+
+/**
+ * Read what a client sent
+ *
+ * return -1 if the connection is to be closed
+ */
+static int client_read(struct serve_client *client) {
+	ssize_t got;
+
+	// full of frames waiting for room in the batch
+	if (SERVE_IN_BUFFER == client->in_len) {
+		return 0;
+	}
+
+	got = read(client->fd, client->in + client->in_len, SERVE_IN_BUFFER - client->in_len);
+	if (got > 0) {
+		client->in_len += got;
+	} else if (0 == got) {
+		client->eof = 1;
+	} else if (errno != EAGAIN && errno != EINTR) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Write the pending responses of a client, as much as the socket takes
+ *
+ * return -1 if the connection is to be closed
+ */
+static int client_write(struct serve_client *client) {
+	ssize_t put;
+
+	while (client->out_pos < client->out_len) {
+		put = write(client->fd, client->out + client->out_pos, client->out_len - client->out_pos);
+		if (put < 0) {
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+		client->out_pos += put;
+	}
+
+	return 0;
+}
+
+static void serve_accept(struct server *server, int listen_fd) {
+	struct serve_client *client;
+	int fd;
+
+	while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+		client = calloc(1, sizeof(*client));
+		if (NULL == client || server->nb_clients == SERVE_MAX_CLIENTS
+			|| NULL == (client->in = malloc(SERVE_IN_BUFFER))) {
+			free(client);
+			close(fd);
+			continue;
+		}
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		client->fd = fd;
+		server->clients[server->nb_clients++] = client;
+	}
+}
+
+/**
+ * Load the keys and build one public and one private context per worker
+ * (in low-latency mode with split != 0)
+ *
+ * return -1 if an error occured
+ */
+static int server_init(struct server *server, int nb_threads, int split) {
+	int i;
+
+	memset(server, 0, sizeof(*server));
+	if (-1 == load_pub(server->n, server->e)) {
+		return -1;
+	}
+	server->loaded = 1;
+	if (-1 == load_priv(&server->K)) {
+		return -1;
+	}
+	server->loaded = 2;
+
+	server->pool  = pool_create(nb_threads);
+	server->pub   = calloc(nb_threads, sizeof(*server->pub));
+	server->priv  = calloc(nb_threads, sizeof(*server->priv));
+	server->batch = malloc(SERVE_BATCH * sizeof(*server->batch));
+	if (NULL == server->pool || NULL == server->pub || NULL == server->priv || NULL == server->batch) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return -1;
+	}
+
+	for (i=0; i<pool_size(server->pool); i++) {
+		if (-1 == rsa_ctx_init_pub(&server->pub[i], server->n, server->e)) {
+			return -1;
+		}
+		if (-1 == rsa_ctx_init_priv(&server->priv[i], &server->K)) {
+			rsa_ctx_clear(&server->pub[i]);
+			return -1;
+		}
+		server->nb_ctx++;
+		if (-1 == rsa_ctx_split(&server->priv[i], split)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void server_clear(struct server *server) {
+	int i;
+
+	while (server->nb_clients > 0) {
+		client_close(server, 0);
+	}
+
+	for (i=0; i<server->nb_ctx; i++) {
+		rsa_ctx_clear(&server->pub[i]);
+		rsa_ctx_clear(&server->priv[i]);
+	}
+	if (NULL != server->pool) {
+		pool_destroy(server->pool);
+	}
+	free(server->pub);
+	free(server->priv);
+	free(server->batch);
+	if (server->loaded > 0) {
+		mpz_clears(server->n, server->e, NULL);
+	}
+	if (server->loaded > 1) {
+		rsa_priv_clear(&server->K);
+	}
+}
+
+/**
+ * Serve encryption and decryption requests on the Unix socket 'path'
+ * with the saved keys, until SIGINT or SIGTERM (the decryptions in
+ * low-latency mode with split != 0, see rsa_ctx_split)
+ * The complete requests of every connection are gathered in one batch,
+ * run on a pool of nb_threads workers, and their latencies (from the
+ * reception of the request to the queueing of the response) kept in
+ * histograms, printed at exit and returned by SERVE_STATS
+ *
+ * return -1 if an error occured
+ */
+int serve(char *path, int nb_threads, int split) {
+	// vars
+	struct sockaddr_un addr;
+	struct pollfd fds[SERVE_MAX_CLIENTS + 1];
+	struct sigaction sa;
+	struct stat st;
+	struct server server;
+	char stats[4096];
+	int listen_fd, i, pending;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	// replacing the socket of a previous run, nothing else
+	if (0 == lstat(path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			printf("'%s' exists and is not a socket.\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	if (-1 == server_init(&server, nb_threads, split)) {
+		printf("%s\n", rsa_errmsg());
+		server_clear(&server);
+		return -1;
+	}
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0) {
+		printf("Unable to listen on '%s'.\n", path);
+		if (listen_fd >= 0) {
+			close(listen_fd);
+		}
+		server_clear(&server);
+		return -1;
+	}
+	fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+
+	// stopping on SIGINT / SIGTERM, poll is interrupted
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Serving on '%s' with %d threads.\n", path, pool_size(server.pool));
+	fflush(stdout);
+
+	pending = 0;
+	while (!serve_stop) {
+		fds[0].fd 	   = listen_fd;
+		fds[0].events  = POLLIN;
+		fds[0].revents = 0;
+		for (i=0; i<server.nb_clients; i++) {
+			fds[i+1].fd 	= server.clients[i]->fd;
+			fds[i+1].events = (server.clients[i]->eof || client_full(server.clients[i]) ? 0 : POLLIN)
+							| (server.clients[i]->out_pos < server.clients[i]->out_len ? POLLOUT : 0);
+			fds[i+1].revents = 0;
+		}
+
+		// frames left over by a full batch: no waiting
+		if (poll(fds, server.nb_clients + 1, pending ? 0 : -1) < 0 && errno != EINTR) {
+			printf("poll failed.\n");
+			break;
+		}
+
+		// reading and gathering the requests
+		for (i=0; i<server.nb_clients; i++) {
+			if (client_full(server.clients[i])) {
+				continue;
+			}
+			if ((fds[i+1].revents & (POLLIN | POLLHUP)) && -1 == client_read(server.clients[i])) {
+				server.clients[i]->eof = 1;
+			}
+			if (-1 == client_parse(&server, server.clients[i])) {
+				printf("Protocol error, closing a connection.\n");
+				server.clients[i]->eof = 1;
+				server.clients[i]->in_len = 0;
+			}
+		}
+
+		if (server.nb_requests > 0) {
+			serve_batch(&server);
+		}
+
+		// writing, closing the finished connections
+		pending = 0;
+		for (i=server.nb_clients-1; i>=0; i--) {
+			if (-1 == client_write(server.clients[i])
+				|| (server.clients[i]->eof && !client_ready(server.clients[i])
+					&& server.clients[i]->out_pos == server.clients[i]->out_len)) {
+				client_close(&server, i);
+			} else if (client_ready(server.clients[i]) && !client_full(server.clients[i])) {
+				pending = 1;
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			serve_accept(&server, listen_fd);
+		}
+	}
+
+	hist_print(&server, stats, sizeof(stats));
+	printf("\n%s", stats);
+
+	close(listen_fd);
+	unlink(path);
+	server_clear(&server);
+	return 0;
+}
+
+/**
+ * Serve the slots submitted on the shared ring 'name' (nb_slots slots)
+ * with the saved keys, until SIGINT or SIGTERM (the decryptions in
+ * low-latency mode with split != 0)
+ * Every slot submitted since the last round is run as one batch on a
+ * pool of nb_threads workers, the results overwrite the inputs, and the
+ * producer is woken up (only if it sleeps) once the batch is done
+ *
+ * return -1 if an error occured
+ */
+int serve_ring(char *name, uint32_t nb_slots, int nb_threads, int split) {
+	// vars
+	struct sigaction sa;
+	struct server server;
+	uint32_t head;
+
+	if (-1 == server_init(&server, nb_threads, split)) {
+		printf("%s\n", rsa_errmsg());
+		server_clear(&server);
+		return -1;
+	}
+
+	server.ring = ring_create(name, nb_slots, server.pub[0].k);
+	if (NULL == server.ring) {
+		printf("%s\n", rsa_errmsg());
+		server_clear(&server);
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = serve_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	printf("Serving on ring '%s' (%u slots) with %d threads.\n", name, server.ring->nb_slots, pool_size(server.pool));
+	fflush(stdout);
+
+	server.ring_tail = 0;
+	while (0 == ring_wait_work(server.ring, server.ring_tail, &head, &serve_stop)) {
+		// never past the slots a producer may have filled
+		if (head - server.ring_tail > server.ring->nb_slots) {
+			head = server.ring_tail + server.ring->nb_slots;
+		}
+
+		pool_run(server.pool, head - server.ring_tail, ring_job, &server);
+		server.ring_tail = head;
+		ring_complete(server.ring, head);
+	}
+
+	ring_detach(server.ring);
+	server_clear(&server);
+	return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * File: rsa_server.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_SERVER_
+#define _H_RSA_SERVER_
+
+#include <stdint.h>
+
+/**
+ * Protocol of --serve, over a Unix stream socket, in native byte order
+ *
+ * Request:  struct serve_frame { op, id, len } then len octets
+ * Response: struct serve_frame { status, id, len } then len octets
+ *
+ * SERVE_ENCRYPT: plaintext of at most k-11 octets -> k octets
+ * SERVE_DECRYPT: ciphertext of k octets -> plaintext
+ * SERVE_STATS:   no payload -> latency histograms, as text
+ *
+ * id is sent back untouched, responses of a connection come in the
+ * order of its requests
+ */
+struct serve_frame {
+	uint32_t op; 		// request: SERVE_*, response: status
+	uint32_t id;
+	uint32_t len;
+};
+
+#define SERVE_ENCRYPT 	1
+#define SERVE_DECRYPT 	2
+#define SERVE_STATS 	3
+
+// status of a response
+#define SERVE_OK 		0
+#define SERVE_EINVAL 	1 	// unknown op or bad length
+#define SERVE_EFAIL 	2 	// the RSA operation failed (bad padding, no key)
+
+// requests handed to the workers at once
+#define SERVE_BATCH 		256
+// default number of slots of --serve-ring
+#define SERVE_RING_SLOTS 	1024
+#define SERVE_MAX_CLIENTS 	256
+// bucket b counts the latencies in [2^b, 2^(b+1)) microseconds
+#define SERVE_HIST_BUCKETS 	32
+
+int serve(char *path, int nb_threads, int split);
+int serve_ring(char *name, uint32_t nb_slots, int nb_threads, int split);
+
+#endif // _H_RSA_SERVER_
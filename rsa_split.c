@@ -0,0 +1,227 @@
+/*
+ * File: rsa_split.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rsa_error.h"
+#include "rsa_pool.h"
+#include "rsa_split.h"
+
+/**
+ * Helper thread running one job at a time next to its owner, pinned to
+ * another CPU than the one its owner runs on (checked at each claim)
+ */
+struct rsa_split {
+	pthread_t thread;
+	int cpu; 					// pinned to, -1 if not
+
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	unsigned long generation; 	// incremented on each split_start
+	int finished; 				// the job of the current generation returned
+	int stop;
+
+	split_job job;
+	void *arg;
+};
+
+// CPUs the process may run on, helpers claimed
+static int split_cpus;
+static int split_running;
+static pthread_once_t split_once = PTHREAD_ONCE_INIT;
+
+static void split_count_cpus(void) {
+	cpu_set_t set;
+
+	split_cpus = 1;
+	if (0 == sched_getaffinity(0, sizeof(set), &set)) {
+		split_cpus = CPU_COUNT(&set);
+	}
+}
+
+static void * split_thread(void *data) {
+	struct rsa_split *split = data;
+	unsigned long seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&split->lock);
+		while (split->generation == seen && !split->stop) {
+			pthread_cond_wait(&split->start, &split->lock);
+		}
+		if (split->stop) {
+			pthread_mutex_unlock(&split->lock);
+			break;
+		}
+		seen = split->generation;
+		pthread_mutex_unlock(&split->lock);
+
+		split->job(split->arg);
+
+		pthread_mutex_lock(&split->lock);
+		__atomic_store_n(&split->finished, 1, __ATOMIC_RELEASE);
+		pthread_cond_signal(&split->done);
+		pthread_mutex_unlock(&split->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Pin the helper to the next allowed CPU after cpu (the one of the
+ * caller)
+ */
+static void split_pin(struct rsa_split *split, int cpu) {
+	cpu_set_t allowed, one;
+	int i, next;
+
+	if (cpu < 0 || 0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		return;
+	}
+
+	for (i=1; i<CPU_SETSIZE; i++) {
+		next = (cpu + i) % CPU_SETSIZE;
+		if (CPU_ISSET(next, &allowed)) {
+			CPU_ZERO(&one);
+			CPU_SET(next, &one);
+			if (0 == pthread_setaffinity_np(split->thread, sizeof(one), &one)) {
+				split->cpu = next;
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * Whether the process may run on more than one CPU
+ */
+int split_available(void) {
+	pthread_once(&split_once, split_count_cpus);
+	return __atomic_load_n(&split_cpus, __ATOMIC_RELAXED) > 1;
+}
+
+/**
+ * Count nb_cpus CPUs instead of the ones the process may run on (to
+ * leave some to other processes, or to test the helpers on one CPU)
+ */
+void split_set_cpus(int nb_cpus) {
+	pthread_once(&split_once, split_count_cpus);
+	__atomic_store_n(&split_cpus, nb_cpus, __ATOMIC_RELAXED);
+}
+
+/**
+ * Create a helper thread
+ *
+ * return NULL if an error occured
+ */
+struct rsa_split * split_create(void) {
+	struct rsa_split *split;
+
+	pthread_once(&split_once, split_count_cpus);
+	split = calloc(1, sizeof(*split));
+	if (NULL == split) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return NULL;
+	}
+
+	pthread_mutex_init(&split->lock, NULL);
+	pthread_cond_init(&split->start, NULL);
+	pthread_cond_init(&split->done, NULL);
+
+	if (pthread_create(&split->thread, NULL, split_thread, split) != 0) {
+		rsa_error(RSA_ETHREAD, "Unable to create a helper thread.");
+		pthread_mutex_destroy(&split->lock);
+		pthread_cond_destroy(&split->start);
+		pthread_cond_destroy(&split->done);
+		free(split);
+		return NULL;
+	}
+	split->cpu = -1;
+	split_pin(split, sched_getcpu());
+
+	return split;
+}
+
+/**
+ * Claim a free CPU for the helper: the workers of the pools currently
+ * running, the helpers already claimed and the caller must leave one
+ * A single compare-exchange: when another thread claims meanwhile, the
+ * caller does not wait for a CPU but runs its job itself
+ * The caller is not pinned: when the scheduler moved it onto the CPU of
+ * the helper, the helper moves to the next one
+ *
+ * return 1 if the CPU is claimed (split_start, then split_wait releases
+ * it), 0 otherwise
+ */
+int split_claim(struct rsa_split *split) {
+	int running = __atomic_load_n(&split_running, __ATOMIC_RELAXED);
+	int cpu;
+
+	if (pool_busy() + running + 2 > __atomic_load_n(&split_cpus, __ATOMIC_RELAXED)
+		|| !__atomic_compare_exchange_n(&split_running, &running, running + 1, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+
+	cpu = sched_getcpu();
+	if (cpu == split->cpu) {
+		split_pin(split, cpu);
+	}
+	return 1;
+}
+
+/**
+ * Run job(arg) on the helper, once split_claim succeeded; split_wait
+ * must be called before the next split_start
+ */
+void split_start(struct rsa_split *split, split_job job, void *arg) {
+	pthread_mutex_lock(&split->lock);
+	split->job 		= job;
+	split->arg 		= arg;
+	split->finished = 0;
+	split->generation++;
+	pthread_cond_signal(&split->start);
+	pthread_mutex_unlock(&split->lock);
+}
+
+/**
+ * Wait for the job of the last split_start to return
+ * Both halves take about as long, so the caller spins a little before
+ * sleeping
+ */
+void split_wait(struct rsa_split *split) {
+	int i;
+
+	for (i=0; i<SPLIT_SPIN && !__atomic_load_n(&split->finished, __ATOMIC_ACQUIRE); i++) {
+		__builtin_ia32_pause();
+	}
+
+	pthread_mutex_lock(&split->lock);
+	while (!split->finished) {
+		pthread_cond_wait(&split->done, &split->lock);
+	}
+	pthread_mutex_unlock(&split->lock);
+
+	__atomic_fetch_sub(&split_running, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stop the helper and free it
+ */
+void split_destroy(struct rsa_split *split) {
+	pthread_mutex_lock(&split->lock);
+	split->stop = 1;
+	pthread_cond_signal(&split->start);
+	pthread_mutex_unlock(&split->lock);
+
+	pthread_join(split->thread, NULL);
+
+	pthread_mutex_destroy(&split->lock);
+	pthread_cond_destroy(&split->start);
+	pthread_cond_destroy(&split->done);
+	free(split);
+}
@@ -0,0 +1,24 @@
+/*
+ * File: rsa_split.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_SPLIT_
+#define _H_RSA_SPLIT_
+
+// pause loops of split_wait before sleeping on the condition variable
+#define SPLIT_SPIN 		4096
+
+typedef void (*split_job)(void *arg);
+
+struct rsa_split;
+
+int split_available(void);
+void split_set_cpus(int nb_cpus);
+struct rsa_split * split_create(void);
+int split_claim(struct rsa_split *split);
+void split_start(struct rsa_split *split, split_job job, void *arg);
+void split_wait(struct rsa_split *split);
+void split_destroy(struct rsa_split *split);
+
+#endif // _H_RSA_SPLIT_
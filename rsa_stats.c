@@ -0,0 +1,86 @@
+/*
+ * File: rsa_stats.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "rsa_error.h"
+#include "rsa_stats.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+	"key_load", "size", "read", "padding", "os2ip", "powm", "i2osp", "unpad", "write"
+};
+
+#ifdef RSA_STATS
+
+int rsa_stats_on;
+struct rsa_stage_stat rsa_stage_stats[STAGE_COUNT];
+
+/**
+ * Start timing the stages, from zero
+ *
+ * return -1 if the library was built without RSA_STATS
+ */
+int rsa_stats_enable(void) {
+	int i;
+
+	for (i=0; i<STAGE_COUNT; i++) {
+		rsa_stage_stats[i].count = 0;
+		rsa_stage_stats[i].ns 	 = 0;
+	}
+	rsa_stats_on = 1;
+
+	return 0;
+}
+
+/**
+ * Print the count and the time of every stage, as a table or as JSON
+ * The times of the workers add up, so they may exceed the elapsed time
+ */
+void rsa_stats_print(FILE *fp, int json) {
+	uint64_t count, ns, total;
+	int i;
+
+	total = 0;
+	for (i=0; i<STAGE_COUNT; i++) {
+		total += rsa_stage_stats[i].ns;
+	}
+
+	if (json) {
+		fprintf(fp, "{\n  \"stages\": [");
+	} else {
+		fprintf(fp, "%-10s %10s %12s %10s %7s\n", "stage", "count", "total ms", "avg us", "share");
+	}
+
+	for (i=0; i<STAGE_COUNT; i++) {
+		count = rsa_stage_stats[i].count;
+		ns 	  = rsa_stage_stats[i].ns;
+		if (json) {
+			fprintf(fp, "%s\n    {\"stage\": \"%s\", \"count\": %" PRIu64 ", \"ns\": %" PRIu64 "}",
+				i > 0 ? "," : "", stage_names[i], count, ns);
+		} else {
+			fprintf(fp, "%-10s %10" PRIu64 " %12.3f %10.3f %6.1f%%\n", stage_names[i], count, ns / 1e6,
+				count > 0 ? ns / 1e3 / count : 0.0, total > 0 ? 100.0 * ns / total : 0.0);
+		}
+	}
+
+	if (json) {
+		fprintf(fp, "\n  ]\n}\n");
+	}
+}
+
+#else
+
+int rsa_stats_enable(void) {
+	rsa_error(RSA_EINVAL, "Statistics are not available (built without RSA_STATS).");
+	return -1;
+}
+
+void rsa_stats_print(FILE *fp, int json) {
+	(void) stage_names;
+}
+
+#endif // RSA_STATS
@@ -0,0 +1,67 @@
+/*
+ * File: rsa_stats.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_STATS_
+#define _H_RSA_STATS_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Stages of an encryption or a decryption run, timed once enabled with
+ * rsa_stats_enable. Built with RSA_STATS only: otherwise STATS_BEGIN and
+ * STATS_END compile to nothing.
+ */
+enum rsa_stage {
+	STAGE_KEY_LOAD,
+	STAGE_SIZE, 		// container header and block index
+	STAGE_READ,
+	STAGE_PADDING, 		// random nonzero octets of PS
+	STAGE_OS2IP,
+	STAGE_POWM, 		// RSAEP or RSADP
+	STAGE_I2OSP,
+	STAGE_UNPAD, 		// EME-PKCS1-v1_5 decoding
+	STAGE_WRITE,
+	STAGE_COUNT
+};
+
+#ifdef RSA_STATS
+
+// one cache line per stage, the workers add to them concurrently
+struct rsa_stage_stat {
+	uint64_t count;
+	uint64_t ns;
+} __attribute__((aligned(64)));
+
+extern int rsa_stats_on;
+extern struct rsa_stage_stat rsa_stage_stats[STAGE_COUNT];
+
+static inline uint64_t stats_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void stats_add(enum rsa_stage stage, uint64_t begin) {
+	__atomic_fetch_add(&rsa_stage_stats[stage].count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&rsa_stage_stats[stage].ns, stats_clock() - begin, __ATOMIC_RELAXED);
+}
+
+#define STATS_BEGIN(t) 		uint64_t t = rsa_stats_on ? stats_clock() : 0
+#define STATS_END(stage, t) do { if (rsa_stats_on) stats_add(stage, t); } while (0)
+
+#else
+
+#define STATS_BEGIN(t)
+#define STATS_END(stage, t)
+
+#endif // RSA_STATS
+
+int rsa_stats_enable(void);
+void rsa_stats_print(FILE *fp, int json);
+
+#endif // _H_RSA_STATS_
@@ -0,0 +1,766 @@
+/*
+ * File: rsa_stream.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "rsa_error.h"
+#include "rsa.h"
+#include "rsa_keys.h"
+#include "rsa_pool.h"
+#include "rsa_rand.h"
+#include "rsa_stream.h"
+#include "rsa_stats.h"
+#include "chacha20.h"
+#include "poly1305.h"
+
+/**
+ * One batch of at most STREAM_BLOCKS blocks, shared by the workers
+ */
+struct stream_batch {
+	struct rsa_pool *pool;
+	struct rsa_ctx *ctx; 	// one per worker
+	int nb_ctx;
+	int k;
+
+	unsigned char *in; 		// input blocks
+	size_t in_len; 			// octets in 'in'
+	unsigned char *out; 	// output blocks, k octets each
+	int *out_len; 			// octets of each output block
+	int error;
+};
+
+/**
+ * Header of an encrypted file (container), followed by the nb_blocks
+ * blocks of k octets, then the index: the plaintext offset of each
+ * block (uint64_t). The fingerprint identifies the public key.
+ */
+struct container_header {
+	char magic[4]; 			// "QRSC"
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t k; 			// length in octets of n
+	uint32_t bits; 			// bit length of n
+	uint64_t fingerprint; 	// key_fingerprint(n)
+	uint64_t size; 			// plaintext octets
+	uint64_t nb_blocks;
+};
+
+/**
+ * Header of a hybrid file, followed by the wrapped key (k octets: the
+ * ChaCha20 key encrypted with RSAES-PKCS1-v1_5) and the payload, sealed
+ * with AEAD_CHACHA20_POLY1305 in chunks of HYBRID_CHUNK octets (the last
+ * one shorter, possibly empty), each followed by its tag. The header
+ * and the wrapped key are the associated data of every chunk, and the
+ * nonce of a chunk is its index, with a flag on the last one: chunks
+ * cannot be altered, reordered, dropped or added. The key is fresh for
+ * every file, hence the nonces from 0.
+ */
+struct hybrid_header {
+	char magic[4]; 			// "QRSH"
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t k; 			// length in octets of n
+};
+
+// octets of a sealed chunk in a hybrid file
+#define HYBRID_SEALED 	(HYBRID_CHUNK + POLY1305_TAG_SIZE)
+
+/**
+ * One batch of at most HYBRID_JOBS chunks of payload, sealed or opened
+ * in place, HYBRID_SEALED octets apart (each tag follows its chunk)
+ */
+struct hybrid_batch {
+	unsigned char key[CHACHA20_KEY_SIZE];
+	unsigned char *aad; 	// header and wrapped key
+	size_t aad_len;
+	uint64_t chunk; 		// index of the first chunk of buf
+	unsigned char *buf;
+	size_t len[HYBRID_JOBS]; // octets of each chunk, tag excluded
+	int nb;
+	int last; 				// the last chunk of buf ends the payload
+	int open; 				// decrypting
+	int error;
+};
+
+/**
+ * Read up to len octets, stopping only at the end of the file
+ */
+static size_t read_full(FILE *in, unsigned char *buf, size_t len) {
+	size_t total, read;
+
+	STATS_BEGIN(t);
+	total = 0;
+	while (total < len && (read = fread(buf + total, 1, len - total, in)) > 0) {
+		total += read;
+	}
+	STATS_END(STAGE_READ, t);
+
+	return total;
+}
+
+/**
+ * Encrypt the chunk i of a batch (run by the workers)
+ */
+static void encrypt_block(void *arg, int i, int worker) {
+	struct stream_batch *batch = arg;
+	size_t offset, mLen;
+
+	offset = (size_t) i * (batch->k-11);
+	mLen   = batch->in_len - offset < batch->k-11 ? batch->in_len - offset : batch->k-11;
+
+	if (-1 == rsa_ctx_encrypt_into(&batch->ctx[worker], batch->out + (size_t) i * batch->k, batch->k,
+								   batch->in + offset, mLen)) {
+		__atomic_store_n(&batch->error, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Decrypt the blocks [i * RSA_BATCH, (i+1) * RSA_BATCH) of a batch, as
+ * one multi-buffer run (run by the workers)
+ */
+static void decrypt_block(void *arg, int i, int worker) {
+	struct stream_batch *batch = arg;
+	size_t first = (size_t) i * RSA_BATCH;
+	int count;
+
+	count = batch->in_len / batch->k - first < RSA_BATCH ? batch->in_len / batch->k - first : RSA_BATCH;
+	if (-1 == rsa_ctx_decrypt_batch_into(&batch->ctx[worker], batch->out + first * batch->k, batch->k,
+										 &batch->out_len[first], batch->in + first * batch->k, count)) {
+		__atomic_store_n(&batch->error, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Build the contexts and buffers of a batch, for the public key (n, e)
+ * or the private key K, 'in_block' octets per input block
+ *
+ * return -1 if an error occured
+ */
+static int batch_init(struct stream_batch *batch, mpz_t n, mpz_t e, struct rsa_priv *K, int in_block, struct rsa_pool *pool) {
+	int i, status;
+
+	memset(batch, 0, sizeof(*batch));
+	batch->pool = pool;
+	batch->ctx 	= malloc(pool_size(pool) * sizeof(*batch->ctx));
+	if (NULL == batch->ctx) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return -1;
+	}
+
+	// each worker has its own context
+	for (i=0; i<pool_size(pool); i++) {
+		status = NULL == K ? rsa_ctx_init_pub(&batch->ctx[i], n, e) : rsa_ctx_init_priv(&batch->ctx[i], K);
+		if (-1 == status) {
+			return -1;
+		}
+		batch->nb_ctx++;
+	}
+	batch->k = batch->ctx[0].k;
+
+	batch->in 	   = malloc((size_t) STREAM_BLOCKS * in_block);
+	batch->out 	   = malloc((size_t) STREAM_BLOCKS * batch->k);
+	batch->out_len = malloc(STREAM_BLOCKS * sizeof(*batch->out_len));
+	if (NULL == batch->in || NULL == batch->out || NULL == batch->out_len) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void batch_clear(struct stream_batch *batch) {
+	int i;
+
+	for (i=0; i<batch->nb_ctx; i++) {
+		rsa_ctx_clear(&batch->ctx[i]);
+	}
+	free(batch->ctx);
+	free(batch->in);
+	free(batch->out);
+	free(batch->out_len);
+}
+
+/**
+ * Encrypt 'in' into the container 'out' with the public key (n, e),
+ * (k-11) octets per block, STREAM_BLOCKS blocks at a time
+ * An empty input still gives one block. The header is completed and
+ * the index appended once every block is written, so 'out' must be
+ * seekable
+ *
+ * size: number of plaintext octets read
+ * return -1 if an error occured
+ */
+int stream_encrypt(FILE *in, FILE *out, mpz_t n, mpz_t e, struct rsa_pool *pool, uint64_t *size) {
+	// vars
+	struct container_header header;
+	struct stream_batch batch;
+	uint64_t i, offset;
+	int k, nb_blocks, status;
+
+	k = rsa_octets(n);
+	status = batch_init(&batch, n, e, NULL, k-11, pool);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CONTAINER_MAGIC, 4);
+	header.version 	   = CONTAINER_VERSION;
+	header.k 		   = k;
+	header.bits 	   = mpz_sizeinbase(n, 2);
+	header.fingerprint = key_fingerprint(n);
+	if (0 == status && fwrite(&header, sizeof(header), 1, out) != 1) {
+		rsa_error(RSA_EIO, "Write error.");
+		status = -1;
+	}
+
+	*size = 0;
+	while (0 == status) {
+		batch.in_len = read_full(in, batch.in, (size_t) STREAM_BLOCKS * (k-11));
+		if (0 == batch.in_len && *size > 0) {
+			break;
+		}
+
+		nb_blocks = (batch.in_len + k-12) / (k-11);
+		if (0 == nb_blocks) {
+			nb_blocks = 1;
+		}
+
+		pool_run(pool, nb_blocks, encrypt_block, &batch);
+		if (__atomic_load_n(&batch.error, __ATOMIC_RELAXED)) {
+			rsa_error(RSA_EINVAL, "Encryption error at offset %" PRIu64 ".", *size);
+			status = -1;
+			break;
+		}
+
+		STATS_BEGIN(t);
+		if (fwrite(batch.out, k, nb_blocks, out) != nb_blocks) {
+			rsa_error(RSA_EIO, "Write error.");
+			status = -1;
+			break;
+		}
+		STATS_END(STAGE_WRITE, t);
+
+		*size += batch.in_len;
+		header.nb_blocks += nb_blocks;
+		if (batch.in_len < (size_t) STREAM_BLOCKS * (k-11)) {
+			break;
+		}
+	}
+
+	// index: plaintext offset of every block
+	for (i=0; 0 == status && i<header.nb_blocks; i++) {
+		offset = i * (k-11);
+		if (fwrite(&offset, sizeof(offset), 1, out) != 1) {
+			rsa_error(RSA_EIO, "Write error.");
+			status = -1;
+		}
+	}
+
+	header.size = *size;
+	if (0 == status && (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1)) {
+		rsa_error(RSA_EIO, "Unable to complete the header (the output must be a regular file).");
+		status = -1;
+	}
+
+	batch_clear(&batch);
+	return status;
+}
+
+/**
+ * Decrypt at most nb_blocks blocks of 'in' (up to the end of the file
+ * with UINT64_MAX), k octets per block, STREAM_BLOCKS blocks at a time
+ * Only the plaintext octets within [start, end) are written, pos being
+ * the plaintext offset of the first block
+ *
+ * size: number of plaintext octets written
+ * return -1 if an error occured
+ */
+static int decrypt_blocks(FILE *in, FILE *out, struct stream_batch *batch, uint64_t nb_blocks,
+						  uint64_t pos, uint64_t start, uint64_t end, uint64_t *size) {
+	// vars
+	uint64_t offset, from, to;
+	size_t len;
+	int k, i, count;
+
+	k 	   = batch->k;
+	offset = 0;
+	while (nb_blocks > 0) {
+		count = nb_blocks < STREAM_BLOCKS ? nb_blocks : STREAM_BLOCKS;
+		batch->in_len = read_full(in, batch->in, (size_t) count * k);
+		if (0 == batch->in_len && UINT64_MAX == nb_blocks) {
+			break;
+		}
+
+		if (batch->in_len != (size_t) count * k && (UINT64_MAX != nb_blocks || batch->in_len % k != 0)) {
+			rsa_error(RSA_EFORMAT, "Truncated block at offset %" PRIu64 ".", offset + batch->in_len - batch->in_len % k);
+			return -1;
+		}
+
+		count = batch->in_len / k;
+		pool_run(batch->pool, (count + RSA_BATCH-1) / RSA_BATCH, decrypt_block, batch);
+		if (__atomic_load_n(&batch->error, __ATOMIC_RELAXED)) {
+			rsa_error(RSA_EDECRYPT, "Decryption error in blocks at offset %" PRIu64 ".", offset);
+			return -1;
+		}
+
+		// writting decrypted data within the range, in order
+		STATS_BEGIN(t);
+		for (i=0; i<count; i++) {
+			from = pos > start ? pos : start;
+			to 	 = pos + batch->out_len[i] < end ? pos + batch->out_len[i] : end;
+			if (from < to) {
+				len = to - from;
+				if (fwrite(batch->out + (size_t) i * k + (from - pos), 1, len, out) != len) {
+					rsa_error(RSA_EIO, "Write error.");
+					return -1;
+				}
+				*size += len;
+			}
+			pos += batch->out_len[i];
+		}
+		STATS_END(STAGE_WRITE, t);
+
+		offset += batch->in_len;
+		if (UINT64_MAX != nb_blocks) {
+			nb_blocks -= count;
+		} else if (count < STREAM_BLOCKS) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Read and check the container header of 'in' against the key K
+ * 'in' is left at the first block, or at its start when it has no
+ * container header (raw blocks of older versions)
+ *
+ * return 1 for a container, 0 for raw blocks, -1 if an error occured
+ */
+static int container_open(FILE *in, struct container_header *header, struct rsa_priv *K) {
+	if (fread(header, sizeof(*header), 1, in) != 1 || memcmp(header->magic, CONTAINER_MAGIC, 4) != 0) {
+		rewind(in);
+		return 0;
+	}
+
+	if (header->version != CONTAINER_VERSION) {
+		rsa_error(RSA_EFORMAT, "Unsupported container version %u.", header->version);
+		return -1;
+	}
+
+	if (header->k != rsa_octets(K->n) || header->fingerprint != key_fingerprint(K->n)) {
+		rsa_error(RSA_EKEY, "The file was encrypted with another key (%u bits).", header->bits);
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * Plaintext offset of block i, from the index of the container
+ *
+ * return -1 if an error occured
+ */
+static int container_index(FILE *in, struct container_header *header, uint64_t i, uint64_t *offset) {
+	long pos;
+
+	pos = sizeof(*header) + header->nb_blocks * header->k + i * sizeof(*offset);
+	if (fseek(in, pos, SEEK_SET) != 0 || fread(offset, sizeof(*offset), 1, in) != 1) {
+		rsa_error(RSA_EFORMAT, "Truncated block index.");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Find the last block of the container whose plaintext starts at or
+ * before x, by a binary search in the index
+ *
+ * return -1 if an error occured
+ */
+static int container_find(FILE *in, struct container_header *header, uint64_t x, uint64_t *block) {
+	uint64_t lo, hi, mid, offset;
+
+	lo = 0;
+	hi = header->nb_blocks - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (-1 == container_index(in, header, mid, &offset)) {
+			return -1;
+		}
+
+		if (offset <= x) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	*block = lo;
+	return 0;
+}
+
+/**
+ * Decrypt the plaintext octets [start, start+len) of 'in' into 'out'
+ * with the private key K (len = UINT64_MAX: up to the end)
+ * In a container, only the blocks covering the range are read: the
+ * first one is found by a binary search in the index. Raw blocks of
+ * older versions are all decrypted
+ *
+ * size: number of plaintext octets written
+ * return -1 if an error occured
+ */
+int stream_decrypt_range(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool,
+						 uint64_t start, uint64_t len, uint64_t *size) {
+	// vars
+	struct container_header header;
+	struct stream_batch batch;
+	uint64_t end, first, last, offset;
+	int status;
+
+	*size = 0;
+	end   = len > UINT64_MAX - start ? UINT64_MAX : start + len;
+	STATS_BEGIN(t);
+	status = container_open(in, &header, K);
+	if (-1 == status) {
+		return -1;
+	}
+
+	if (-1 == batch_init(&batch, K->n, NULL, K, rsa_octets(K->n), pool)) {
+		batch_clear(&batch);
+		return -1;
+	}
+
+	// raw blocks
+	if (0 == status) {
+		status = decrypt_blocks(in, out, &batch, UINT64_MAX, 0, start, end, size);
+		batch_clear(&batch);
+		return status;
+	}
+
+	if (start >= header.size || start >= end || 0 == header.nb_blocks) {
+		batch_clear(&batch);
+		return 0;
+	}
+
+	// the blocks holding start and end - 1
+	status = container_find(in, &header, start, &first);
+	if (0 == status) {
+		status = container_find(in, &header, end - 1, &last);
+	}
+	if (0 == status) {
+		status = container_index(in, &header, first, &offset);
+	}
+	if (0 == status && fseek(in, sizeof(header) + first * header.k, SEEK_SET) != 0) {
+		rsa_error(RSA_EFORMAT, "Truncated block at offset %" PRIu64 ".", first * header.k);
+		status = -1;
+	}
+	STATS_END(STAGE_SIZE, t);
+
+	if (0 == status) {
+		status = decrypt_blocks(in, out, &batch, last - first + 1, offset, start, end, size);
+	}
+
+	if (0 == status && end >= header.size && *size != header.size - start) {
+		rsa_error(RSA_EFORMAT, "The container holds %" PRIu64 " octets instead of %" PRIu64 ".", start + *size, header.size);
+		status = -1;
+	}
+
+	batch_clear(&batch);
+	return status;
+}
+
+/**
+ * Decrypt 'in' into 'out' with the private key K
+ *
+ * size: number of plaintext octets written
+ * return -1 if an error occured
+ */
+int stream_decrypt(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool, uint64_t *size) {
+	return stream_decrypt_range(in, out, K, pool, 0, UINT64_MAX, size);
+}
+
+/**
+ * Nonce of a chunk: the flag of the last one, then its index
+ */
+static void hybrid_nonce(unsigned char *nonce, uint64_t chunk, int last) {
+	int i;
+
+	nonce[0] = last;
+	nonce[1] = nonce[2] = nonce[3] = 0;
+	for (i=0; i<8; i++) {
+		nonce[4 + i] = chunk >> (8*i);
+	}
+}
+
+/**
+ * Seal or open the chunk i of a batch (run by the workers)
+ */
+static void hybrid_chunk(void *arg, int i, int worker) {
+	struct hybrid_batch *batch = arg;
+	unsigned char nonce[CHACHA20_NONCE_SIZE];
+	unsigned char *chunk;
+	size_t len;
+
+	// every chunk needs the same state, whatever the worker
+	(void) worker;
+
+	chunk = batch->buf + (size_t) i * HYBRID_SEALED;
+	len   = batch->len[i];
+	hybrid_nonce(nonce, batch->chunk + i, batch->last && i == batch->nb - 1);
+
+	if (!batch->open) {
+		chacha20_poly1305_seal(batch->key, nonce, batch->aad, batch->aad_len, chunk, len, chunk + len);
+	} else if (-1 == chacha20_poly1305_open(batch->key, nonce, batch->aad, batch->aad_len, chunk, len, chunk + len)) {
+		__atomic_store_n(&batch->error, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Tell whether 'in' is at its end, without moving it
+ */
+static int at_end(FILE *in) {
+	int c;
+
+	c = getc(in);
+	if (EOF == c) {
+		return 1;
+	}
+	ungetc(c, in);
+	return 0;
+}
+
+/**
+ * Copy 'in' to 'out', sealing (or opening, batch->open) its chunks,
+ * HYBRID_JOBS of them at a time. batch holds the key and the associated
+ * data.
+ *
+ * size: number of plaintext octets read (or written)
+ * return -1 if an error occured
+ */
+static int hybrid_copy(FILE *in, FILE *out, struct hybrid_batch *batch, struct rsa_pool *pool, uint64_t *size) {
+	// vars
+	size_t chunk_len, read, written;
+	int status, i;
+
+	batch->buf = malloc((size_t) HYBRID_JOBS * HYBRID_SEALED);
+	if (NULL == batch->buf) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		return -1;
+	}
+
+	// plaintext chunks, or sealed ones with their tag
+	chunk_len = batch->open ? HYBRID_SEALED : HYBRID_CHUNK;
+
+	*size 		 = 0;
+	status 		 = 0;
+	batch->chunk = 0;
+	batch->last  = 0;
+	batch->error = 0;
+	while (0 == status && !batch->last) {
+		for (batch->nb=0; batch->nb<HYBRID_JOBS && !batch->last; batch->nb++) {
+			read = read_full(in, batch->buf + (size_t) batch->nb * HYBRID_SEALED, chunk_len);
+			batch->last = read < chunk_len || at_end(in);
+			batch->len[batch->nb] = read;
+			if (!batch->open) {
+				continue;
+			}
+
+			if (read < POLY1305_TAG_SIZE) {
+				rsa_error(RSA_EFORMAT, "Truncated payload at chunk %" PRIu64 ".", batch->chunk + batch->nb);
+				status = -1;
+				break;
+			}
+			batch->len[batch->nb] -= POLY1305_TAG_SIZE;
+		}
+
+		if (0 == status && ferror(in)) {
+			rsa_error(RSA_EIO, "Read error.");
+			status = -1;
+		}
+		if (-1 == status) {
+			break;
+		}
+
+		pool_run(pool, batch->nb, hybrid_chunk, batch);
+		if (__atomic_load_n(&batch->error, __ATOMIC_RELAXED)) {
+			rsa_error(RSA_EDECRYPT, "Authentication failed in chunks %" PRIu64 " to %" PRIu64 ": the file is corrupted or truncated.",
+				batch->chunk, batch->chunk + batch->nb - 1);
+			status = -1;
+			break;
+		}
+
+		// the tags go with the sealed chunks only
+		STATS_BEGIN(t);
+		for (i=0; i<batch->nb; i++) {
+			written = batch->len[i] + (batch->open ? 0 : POLY1305_TAG_SIZE);
+			if (fwrite(batch->buf + (size_t) i * HYBRID_SEALED, 1, written, out) != written) {
+				rsa_error(RSA_EIO, "Write error.");
+				status = -1;
+				break;
+			}
+			*size += batch->len[i];
+		}
+		STATS_END(STAGE_WRITE, t);
+
+		batch->chunk += batch->nb;
+	}
+
+	memset(batch->buf, 0, (size_t) HYBRID_JOBS * HYBRID_SEALED);
+	free(batch->buf);
+	return status;
+}
+
+/**
+ * Tell whether 'in' starts with a hybrid header, leaving it at its start
+ */
+int stream_is_hybrid(FILE *in) {
+	char magic[4];
+	int hybrid;
+
+	hybrid = fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, HYBRID_MAGIC, 4) == 0;
+	rewind(in);
+
+	return hybrid;
+}
+
+/**
+ * Encrypt 'in' into 'out' in hybrid mode: a random ChaCha20 key is
+ * wrapped once with the public key (n, e), then encrypts the payload
+ *
+ * size: number of plaintext octets read
+ * return -1 if an error occured
+ */
+int stream_hybrid_encrypt(FILE *in, FILE *out, mpz_t n, mpz_t e, struct rsa_pool *pool, uint64_t *size) {
+	// vars
+	struct hybrid_header header;
+	struct hybrid_batch batch;
+	struct rsa_ctx ctx;
+	unsigned char *C;
+	int status;
+
+	if (-1 == rsa_ctx_init_pub(&ctx, n, e)) {
+		return -1;
+	}
+
+	// wrapping a fresh key
+	C = NULL;
+	if (rand_bytes(batch.key, sizeof(batch.key)) == 0) {
+		C = rsa_ctx_encrypt(&ctx, batch.key, sizeof(batch.key));
+	}
+	batch.aad_len = sizeof(header) + ctx.k;
+	batch.aad 	  = NULL == C ? NULL : malloc(batch.aad_len);
+	if (NULL == batch.aad) {
+		if (NULL != C) {
+			rsa_error(RSA_ENOMEM, "Memory error.");
+		}
+		memset(batch.key, 0, sizeof(batch.key));
+		rsa_ctx_clear(&ctx);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HYBRID_MAGIC, 4);
+	header.version = HYBRID_VERSION;
+	header.k 	   = ctx.k;
+	memcpy(batch.aad, &header, sizeof(header));
+	memcpy(batch.aad + sizeof(header), C, ctx.k);
+
+	if (fwrite(batch.aad, batch.aad_len, 1, out) != 1) {
+		rsa_error(RSA_EIO, "Write error.");
+		status = -1;
+	} else {
+		batch.open = 0;
+		status = hybrid_copy(in, out, &batch, pool, size);
+	}
+
+	memset(batch.key, 0, sizeof(batch.key));
+	free(batch.aad);
+	rsa_ctx_clear(&ctx);
+	return status;
+}
+
+/**
+ * Decrypt the hybrid file 'in' into 'out': unwrap the ChaCha20 key with
+ * the private key K, then decrypt the payload
+ * The chunks are written as they authenticate: on an error, 'out' may
+ * hold the plaintext of the chunks before the failing one, and the
+ * caller must discard it
+ *
+ * size: number of plaintext octets written
+ * return -1 if an error occured
+ */
+int stream_hybrid_decrypt(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool, uint64_t *size) {
+	// vars
+	struct hybrid_header header;
+	struct hybrid_batch batch;
+	struct rsa_ctx ctx;
+	unsigned char *C, *M;
+	int mLen, status;
+
+	if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, HYBRID_MAGIC, 4) != 0) {
+		rsa_error(RSA_EFORMAT, "Malformed hybrid header.");
+		return -1;
+	}
+
+	// version 1 payloads had no tag: nothing tells whether they are intact
+	if (header.version != HYBRID_VERSION) {
+		rsa_error(RSA_EFORMAT, "Unsupported hybrid file version %u (unauthenticated), expected %u.",
+			header.version, HYBRID_VERSION);
+		return -1;
+	}
+
+	if (-1 == rsa_ctx_init_priv(&ctx, K)) {
+		return -1;
+	}
+
+	if (header.k != ctx.k) {
+		rsa_error(RSA_EKEY, "The file was encrypted for a %u-octet modulus, the key has %d.", header.k, ctx.k);
+		rsa_ctx_clear(&ctx);
+		return -1;
+	}
+
+	// unwrapping the key, the header and the wrapped key being the
+	// associated data of the chunks
+	batch.aad_len = sizeof(header) + ctx.k;
+	batch.aad 	  = malloc(batch.aad_len);
+	if (NULL == batch.aad) {
+		rsa_error(RSA_ENOMEM, "Memory error.");
+		rsa_ctx_clear(&ctx);
+		return -1;
+	}
+
+	C = batch.aad + sizeof(header);
+	memcpy(batch.aad, &header, sizeof(header));
+	if (fread(C, ctx.k, 1, in) != 1) {
+		rsa_error(RSA_EFORMAT, "Truncated wrapped key.");
+		free(batch.aad);
+		rsa_ctx_clear(&ctx);
+		return -1;
+	}
+
+	M = rsa_ctx_decrypt(&ctx, C, ctx.k, &mLen);
+	if (NULL == M || mLen != CHACHA20_KEY_SIZE) {
+		rsa_error(RSA_EDECRYPT, "Unable to unwrap the file key.");
+		free(batch.aad);
+		rsa_ctx_clear(&ctx);
+		return -1;
+	}
+
+	memcpy(batch.key, M, sizeof(batch.key));
+	memset(M, 0, mLen);
+	rsa_ctx_clear(&ctx);
+
+	batch.open = 1;
+	status = hybrid_copy(in, out, &batch, pool, size);
+	memset(batch.key, 0, sizeof(batch.key));
+	free(batch.aad);
+	return status;
+}
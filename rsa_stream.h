@@ -0,0 +1,38 @@
+/*
+ * File: rsa_stream.h
+ * Created by Hamza ESSAYEGH (Querdos)
+ */
+
+#ifndef _H_RSA_STREAM_
+#define _H_RSA_STREAM_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_pool.h"
+
+// blocks transformed per batch, the buffers never grow past that
+#define STREAM_BLOCKS 	256
+
+// container of RSA blocks
+#define CONTAINER_MAGIC 	"QRSC"
+#define CONTAINER_VERSION 	1
+
+// hybrid files: octets of payload per job (and per tag), jobs per batch
+#define HYBRID_MAGIC 	"QRSH"
+#define HYBRID_VERSION 	2
+#define HYBRID_CHUNK 	(64 * 1024)
+#define HYBRID_JOBS 	64
+
+int stream_encrypt(FILE *in, FILE *out, mpz_t n, mpz_t e, struct rsa_pool *pool, uint64_t *size);
+int stream_decrypt(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool, uint64_t *size);
+int stream_decrypt_range(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool,
+						 uint64_t start, uint64_t len, uint64_t *size);
+
+int stream_is_hybrid(FILE *in);
+int stream_hybrid_encrypt(FILE *in, FILE *out, mpz_t n, mpz_t e, struct rsa_pool *pool, uint64_t *size);
+int stream_hybrid_decrypt(FILE *in, FILE *out, struct rsa_priv *K, struct rsa_pool *pool, uint64_t *size);
+
+#endif // _H_RSA_STREAM_
@@ -0,0 +1,177 @@
+/*
+ * File: tests/test_aead.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ *
+ * AEAD_CHACHA20_POLY1305 against RFC 8439 2.8.2, and hybrid files
+ * round-tripped, then rejected once altered, truncated or extended.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_error.h"
+#include "rsa_pool.h"
+#include "rsa_stream.h"
+#include "poly1305.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+static void hex(unsigned char *out, const char *s) {
+	unsigned int b;
+
+	for (; *s; s+=2, out++) {
+		sscanf(s, "%2x", &b);
+		*out = b;
+	}
+}
+
+static void rfc8439(void) {
+	// vars
+	const char *plaintext = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+							"for the future, sunscreen would be it.";
+	unsigned char key[32], nonce[12], aad[12], cipher[114], tag[16], buf[114], got[16];
+	size_t len = strlen(plaintext);
+	int i;
+
+	for (i=0; i<32; i++) {
+		key[i] = 0x80 + i;
+	}
+	hex(nonce, "070000004041424344454647");
+	hex(aad, "50515253c0c1c2c3c4c5c6c7");
+	hex(cipher, "d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+				"3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+				"92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+				"3ff4def08e4b7a9de576d26586cec64b6116");
+	hex(tag, "1ae10b594f09e26a7e902ecbd0600691");
+
+	memcpy(buf, plaintext, len);
+	chacha20_poly1305_seal(key, nonce, aad, sizeof(aad), buf, len, got);
+	CHECK(memcmp(buf, cipher, len) == 0, "rfc8439: ciphertext");
+	CHECK(memcmp(got, tag, 16) == 0, "rfc8439: tag");
+
+	CHECK(chacha20_poly1305_open(key, nonce, aad, sizeof(aad), buf, len, tag) == 0, "rfc8439: open");
+	CHECK(memcmp(buf, plaintext, len) == 0, "rfc8439: plaintext");
+
+	// a wrong tag leaves the ciphertext untouched
+	memcpy(buf, cipher, len);
+	tag[15] ^= 1;
+	CHECK(chacha20_poly1305_open(key, nonce, aad, sizeof(aad), buf, len, tag) == -1, "rfc8439: altered tag accepted");
+	CHECK(memcmp(buf, cipher, len) == 0, "rfc8439: altered tag, buffer modified");
+}
+
+/**
+ * Decrypt the len first octets of an hybrid file, with the octet 'flip'
+ * altered (unless -1), and compare with 'data'
+ */
+static int hybrid_open(unsigned char *file, size_t len, long flip, unsigned char *data, size_t size,
+					   struct rsa_priv *K, struct rsa_pool *pool) {
+	// vars
+	FILE *in, *out;
+	unsigned char *got;
+	uint64_t got_size;
+	int status;
+
+	if (flip >= 0) {
+		file[flip] ^= 0x10;
+	}
+	in  = tmpfile();
+	out = tmpfile();
+	fwrite(file, 1, len, in);
+	rewind(in);
+	status = stream_hybrid_decrypt(in, out, K, pool, &got_size);
+	if (flip >= 0) {
+		file[flip] ^= 0x10;
+	}
+
+	if (0 == status) {
+		got = malloc(size + 1);
+		rewind(out);
+		status = got_size == size && fread(got, 1, size + 1, out) == size && memcmp(got, data, size) == 0 ? 0 : -2;
+		free(got);
+	}
+	fclose(in);
+	fclose(out);
+	return status;
+}
+
+static void hybrid(struct rsa_priv *K, mpz_t e, struct rsa_pool *pool, size_t size) {
+	// vars
+	unsigned char *data, *file;
+	size_t len, tail;
+	uint64_t got_size;
+	FILE *in, *out;
+	size_t i;
+
+	data = malloc(size + 1);
+	for (i=0; i<size; i++) {
+		data[i] = rand();
+	}
+	in  = tmpfile();
+	out = tmpfile();
+	fwrite(data, 1, size, in);
+	rewind(in);
+	CHECK(stream_hybrid_encrypt(in, out, K->n, e, pool, &got_size) == 0 && got_size == size,
+		"hybrid %zu: encrypt (%s)", size, rsa_errmsg());
+	fclose(in);
+
+	len  = ftell(out);
+	file = malloc(len + 1);
+	rewind(out);
+	CHECK(fread(file, 1, len, out) == len, "hybrid %zu: read back", size);
+	fclose(out);
+
+	// last chunk and its tag
+	tail = size % HYBRID_CHUNK + POLY1305_TAG_SIZE;
+	if (size > 0 && size % HYBRID_CHUNK == 0) {
+		tail = HYBRID_CHUNK + POLY1305_TAG_SIZE;
+	}
+
+	CHECK(hybrid_open(file, len, -1, data, size, K, pool) == 0, "hybrid %zu: decrypt (%s)", size, rsa_errmsg());
+	CHECK(hybrid_open(file, len, 5, data, size, K, pool) == -1, "hybrid %zu: altered version accepted", size);
+	CHECK(hybrid_open(file, len, 12, data, size, K, pool) == -1, "hybrid %zu: altered wrapped key accepted", size);
+	CHECK(hybrid_open(file, len, len - 1, data, size, K, pool) == -1, "hybrid %zu: altered tag accepted", size);
+	CHECK(hybrid_open(file, len, len - tail, data, size, K, pool) == -1, "hybrid %zu: altered last chunk accepted", size);
+	CHECK(hybrid_open(file, len - 1, -1, data, size, K, pool) == -1, "hybrid %zu: truncated file accepted", size);
+	CHECK(hybrid_open(file, len - tail, -1, data, size, K, pool) == -1, "hybrid %zu: last chunk dropped", size);
+	file[len] = 0;
+	CHECK(hybrid_open(file, len + 1, -1, data, size, K, pool) == -1, "hybrid %zu: trailing octet accepted", size);
+
+	free(file);
+	free(data);
+}
+
+int main() {
+	// vars
+	struct rsa_priv K;
+	struct rsa_pool *pool;
+	mpz_t e;
+
+	rfc8439();
+
+	mpz_init(e);
+	rsa_priv_init(&K);
+	pool = pool_create(3);
+	if (NULL == pool || -1 == generate_keypair(e, &K, 1024, 1)) {
+		printf("FAIL setup: %s\n", rsa_errmsg());
+		return 1;
+	}
+
+	hybrid(&K, e, pool, 0);
+	hybrid(&K, e, pool, 3);
+	hybrid(&K, e, pool, HYBRID_CHUNK);
+	hybrid(&K, e, pool, 3*HYBRID_CHUNK + 100);
+	hybrid(&K, e, pool, HYBRID_JOBS*HYBRID_CHUNK);
+	hybrid(&K, e, pool, HYBRID_JOBS*HYBRID_CHUNK + 1);
+
+	pool_destroy(pool);
+	rsa_priv_clear(&K);
+	mpz_clear(e);
+
+	printf("%s: %d failure(s)\n", __FILE__, failures);
+	return failures != 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * File: tests/test_arena.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ *
+ * The GMP arenas of --arena-secure: pools of threads encrypt and decrypt
+ * with their own contexts then exit, round after round. The rest of the
+ * chunk of a thread that left is carved by the next one, and the blocks
+ * freed by a thread that never allocated reach the depot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_alloc.h"
+#include "rsa_error.h"
+#include "rsa_pool.h"
+
+#define NB_THREADS 	4
+#define NB_ROUNDS 	128
+#define NB_JOBS 	16
+// blocks of a class of their own, first one of a thread that leaves
+// then one of the next thread
+#define REST_FIRST 	(32 * 1024)
+#define REST_NEXT 	(16 * 1024)
+// blocks of the largest class, allocated and freed by different threads
+#define NB_BLOCKS 	8
+#define BLOCK_SIZE 	(48 * 1024)
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+struct round {
+	mpz_t e;
+	struct rsa_priv *K;
+	int errors;
+};
+
+/**
+ * Encrypt and decrypt a block with contexts of the worker (run by the
+ * workers): every integer comes from the arena of the thread
+ */
+static void round_job(void *arg, int i, int worker) {
+	struct round *round = arg;
+	struct rsa_ctx pub, priv;
+	unsigned char M[64], C[RSA_MAX_BITS / 8], *P;
+	int mLen, j;
+
+	(void) worker;
+
+	for (j=0; j<(int) sizeof(M); j++) {
+		M[j] = i + j;
+	}
+
+	if (-1 == rsa_ctx_init_pub(&pub, round->K->n, round->e)) {
+		__atomic_add_fetch(&round->errors, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	if (-1 == rsa_ctx_init_priv(&priv, round->K)) {
+		__atomic_add_fetch(&round->errors, 1, __ATOMIC_RELAXED);
+		rsa_ctx_clear(&pub);
+		return;
+	}
+
+	P = NULL;
+	if (-1 != rsa_ctx_encrypt_into(&pub, C, sizeof(C), M, sizeof(M))) {
+		P = rsa_ctx_decrypt(&priv, C, pub.k, &mLen);
+	}
+	if (NULL == P || mLen != sizeof(M) || memcmp(P, M, sizeof(M)) != 0) {
+		__atomic_add_fetch(&round->errors, 1, __ATOMIC_RELAXED);
+	}
+
+	rsa_ctx_clear(&pub);
+	rsa_ctx_clear(&priv);
+}
+
+struct blocks {
+	void *ptr[NB_BLOCKS];
+	void *(*alloc)(size_t);
+	void (*free)(void *, size_t);
+};
+
+static void * free_blocks(void *arg) {
+	struct blocks *blocks = arg;
+	int i;
+
+	for (i=0; i<NB_BLOCKS; i++) {
+		blocks->free(blocks->ptr[i], BLOCK_SIZE);
+	}
+	return NULL;
+}
+
+static void * alloc_blocks(void *arg) {
+	struct blocks *blocks = arg;
+	int i;
+
+	for (i=0; i<NB_BLOCKS; i++) {
+		blocks->ptr[i] = blocks->alloc(BLOCK_SIZE);
+	}
+	return NULL;
+}
+
+/**
+ * Blocks allocated here, freed by a thread that only frees and leaves:
+ * the next thread gets them from the depot
+ */
+static void freed_elsewhere(void) {
+	struct blocks mine, reused;
+	pthread_t thread;
+	int i, j, found;
+
+	mp_get_memory_functions(&mine.alloc, NULL, &mine.free);
+	reused = mine;
+
+	alloc_blocks(&mine);
+	if (pthread_create(&thread, NULL, free_blocks, &mine) != 0) {
+		printf("FAIL thread\n");
+		failures++;
+		return;
+	}
+	pthread_join(thread, NULL);
+
+	if (pthread_create(&thread, NULL, alloc_blocks, &reused) != 0) {
+		printf("FAIL thread\n");
+		failures++;
+		return;
+	}
+	pthread_join(thread, NULL);
+
+	for (i=0; i<NB_BLOCKS; i++) {
+		for (found=0, j=0; j<NB_BLOCKS; j++) {
+			found |= reused.ptr[i] == mine.ptr[j];
+		}
+		CHECK(found, "block %d of a thread that only freed not in the depot", i);
+		reused.free(reused.ptr[i], BLOCK_SIZE);
+	}
+}
+
+struct rest {
+	void *(*alloc)(size_t);
+	size_t size;
+	void *ptr;
+};
+
+static void * alloc_one(void *arg) {
+	struct rest *rest = arg;
+
+	rest->ptr = rest->alloc(rest->size);
+	return NULL;
+}
+
+/**
+ * A thread carves a block from a chunk and leaves: the next thread
+ * needing a block of a class the depot does not hold carves it right
+ * after, from the rest of that chunk
+ */
+static void rest_reused(void) {
+	struct rest first, next;
+	void (*free_block)(void *, size_t);
+	pthread_t thread;
+
+	mp_get_memory_functions(&first.alloc, NULL, &free_block);
+	next = first;
+	first.size = REST_FIRST;
+	next.size  = REST_NEXT;
+
+	if (pthread_create(&thread, NULL, alloc_one, &first) != 0) {
+		printf("FAIL thread\n");
+		failures++;
+		return;
+	}
+	pthread_join(thread, NULL);
+	if (pthread_create(&thread, NULL, alloc_one, &next) != 0) {
+		printf("FAIL thread\n");
+		failures++;
+		return;
+	}
+	pthread_join(thread, NULL);
+
+	// the blocks are 16 octets after their header
+	CHECK((unsigned char *) next.ptr == (unsigned char *) first.ptr + REST_FIRST + 16,
+		"rest of a chunk not reused: %p after %p", next.ptr, first.ptr);
+	free_block(first.ptr, REST_FIRST);
+	free_block(next.ptr, REST_NEXT);
+}
+
+int main() {
+	// vars
+	struct rsa_priv K;
+	struct rsa_pool *pool;
+	struct round round;
+	int r;
+
+	if (-1 == rsa_alloc_install(RSA_ALLOC_SECURE)) {
+		printf("FAIL install: %s\n", rsa_errmsg());
+		return 1;
+	}
+	CHECK(-1 == rsa_alloc_install(0), "installed twice");
+	freed_elsewhere();
+	rest_reused();
+
+	mpz_init(round.e);
+	rsa_priv_init(&K);
+	if (-1 == generate_keypair(round.e, &K, 1024, 1)) {
+		printf("FAIL setup: %s\n", rsa_errmsg());
+		return 1;
+	}
+	round.K 	 = &K;
+	round.errors = 0;
+
+	for (r=0; r<NB_ROUNDS; r++) {
+		pool = pool_create(NB_THREADS);
+		if (NULL == pool) {
+			printf("FAIL pool: %s\n", rsa_errmsg());
+			return 1;
+		}
+		pool_run(pool, NB_JOBS, round_job, &round);
+		pool_destroy(pool);
+	}
+
+	CHECK(0 == round.errors, "%d round trips failed", round.errors);
+
+	rsa_priv_clear(&K);
+	mpz_clear(round.e);
+
+	printf("%s: %d failure(s)\n", __FILE__, failures);
+	return failures != 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * File: tests/test_mont.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ *
+ * The mulx/adx kernels of 16 and 32 limbs (mont_powm, mont_powm_ui, rsaep)
+ * against mpz_powm: random moduli, bases and exponents, and the edges
+ * (bases 0, 1, m - 1 and up to R^2 - 1, exponents 0, 1 and past m,
+ * moduli of a single top bit set, of a small top limb, R - 1).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_mont.h"
+
+#define NB_MODULI 	16
+#define NB_ROUNDS 	8
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { gmp_printf("FAIL " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/**
+ * Compare mont_powm and mont_powm_ui with mpz_powm for b and e, r
+ * aliasing b and e too
+ */
+static void check(struct rsa_mont *M, mpz_t m, mpz_t b, mpz_t e, unsigned long e_ui) {
+	mpz_t expected, got;
+
+	mpz_inits(expected, got, NULL);
+
+	mpz_powm(expected, b, e, m);
+	CHECK(0 == mont_powm(got, b, e, M) && 0 == mpz_cmp(got, expected),
+		"mont_powm, %d limbs: m %Zx, b %Zx, e %Zx", M->n, m, b, e);
+	mpz_set(got, b);
+	CHECK(0 == mont_powm(got, got, e, M) && 0 == mpz_cmp(got, expected), "mont_powm, r = b, %d limbs", M->n);
+	mpz_set(got, e);
+	CHECK(0 == mont_powm(got, b, got, M) && 0 == mpz_cmp(got, expected), "mont_powm, r = e, %d limbs", M->n);
+
+	mpz_powm_ui(expected, b, e_ui, m);
+	CHECK(0 == mont_powm_ui(got, b, e_ui, M) && 0 == mpz_cmp(got, expected),
+		"mont_powm_ui, %d limbs: m %Zx, b %Zx, e %lu", M->n, m, b, e_ui);
+
+	mpz_clears(expected, got, NULL);
+}
+
+static void check_modulus(gmp_randstate_t state, mpz_t m) {
+	static const unsigned long public[] = { 1, 2, 3, 17, 65537, ULONG_MAX };
+	struct rsa_mont M;
+	mpz_t b, e, R2;
+	int n = mpz_size(m), i;
+
+	if (-1 == mont_init(&M, m)) {
+		CHECK(0, "mont_init, %d limbs: m %Zx", n, m);
+		return;
+	}
+	mpz_inits(b, e, R2, NULL);
+	mpz_setbit(R2, (mp_bitcnt_t) 2 * n * GMP_LIMB_BITS);
+
+	// the edges
+	mpz_set_ui(e, 0);
+	mpz_set_ui(b, 5);
+	check(&M, m, b, e, 1);
+	mpz_set_ui(e, 1);
+	mpz_set_ui(b, 0);
+	check(&M, m, b, e, 65537);
+	mpz_set_ui(b, 1);
+	check(&M, m, b, e, 3);
+	mpz_sub_ui(b, m, 1);
+	check(&M, m, b, e, 1);
+	mpz_sub_ui(e, m, 1);
+	check(&M, m, b, e, 2);
+	mpz_set(b, m);
+	check(&M, m, b, e, 17);
+	mpz_sub_ui(b, R2, 1);
+	check(&M, m, b, e, ULONG_MAX);
+	mpz_sub_ui(e, R2, 1);
+	check(&M, m, b, e, ULONG_MAX - 1);
+
+	for (i=0; i<NB_ROUNDS; i++) {
+		// bases below m, then below R^2 (any ciphertext of n = p * q)
+		mpz_urandomm(b, state, i % 2 ? R2 : m);
+		mpz_urandomb(e, state, 1 + gmp_urandomm_ui(state, n * GMP_LIMB_BITS));
+		check(&M, m, b, e, i < 6 ? public[i] : gmp_urandomb_ui(state, GMP_LIMB_BITS) | 1);
+	}
+
+	// the one-shot rsaep, below m
+	mpz_urandomm(b, state, m);
+	for (i=0; i<6; i++) {
+		mpz_set_ui(e, public[i]);
+		mpz_powm(R2, b, e, m);
+		CHECK(0 == rsaep(e, m, e, b) && 0 == mpz_cmp(e, R2), "rsaep, %d limbs, e %lu", n, public[i]);
+	}
+
+	mpz_clears(b, e, R2, NULL);
+	mont_clear(&M);
+}
+
+int main() {
+	// vars
+	static const int limbs[] = { MONT_LIMBS_1024, MONT_LIMBS_2048 };
+	gmp_randstate_t state;
+	mpz_t m;
+	int i, j, bits;
+
+	if (!mont_available()) {
+		printf("%s: no BMI2/ADX, skipped\n", __FILE__);
+		return 0;
+	}
+
+	gmp_randinit_default(state);
+	gmp_randseed_ui(state, 8439);
+	mpz_init(m);
+
+	for (j=0; j<2; j++) {
+		bits = limbs[j] * GMP_LIMB_BITS;
+
+		// 2^(bits-1) + 1, R - 1, a top limb of 1
+		mpz_set_ui(m, 1);
+		mpz_setbit(m, bits - 1);
+		check_modulus(state, m);
+		mpz_set_ui(m, 0);
+		mpz_setbit(m, bits);
+		mpz_sub_ui(m, m, 1);
+		check_modulus(state, m);
+		mpz_urandomb(m, state, bits - GMP_LIMB_BITS);
+		mpz_setbit(m, bits - GMP_LIMB_BITS);
+		mpz_setbit(m, 0);
+		check_modulus(state, m);
+
+		// random, the top bit set
+		for (i=0; i<NB_MODULI; i++) {
+			mpz_urandomb(m, state, bits);
+			mpz_setbit(m, bits - 1);
+			mpz_setbit(m, 0);
+			check_modulus(state, m);
+		}
+	}
+
+	// no kernel: even moduli, other sizes
+	{
+		struct rsa_mont M;
+
+		mpz_set_ui(m, 0);
+		mpz_setbit(m, 1024 - 1);
+		CHECK(-1 == mont_init(&M, m) && 0 == M.n, "even modulus accepted");
+		mpz_setbit(m, 0);
+		mpz_setbit(m, 1536 - 1);
+		CHECK(-1 == mont_init(&M, m) && -1 == mont_powm_ui(m, m, 3, &M), "1536-bit modulus accepted");
+	}
+
+	mpz_clear(m);
+	gmp_randclear(state);
+
+	printf("%s: %d failure(s)\n", __FILE__, failures);
+	return failures != 0;
+}
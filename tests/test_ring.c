@@ -0,0 +1,231 @@
+/*
+ * File: tests/test_ring.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ *
+ * A producer of --serve-ring: the slots are filled in sequence, handed
+ * over in groups, and the result of a slot is taken back just before
+ * the slot is filled again. Encrypts blocks through the ring, decrypts
+ * them back, and checks that bad slots are refused.
+ *
+ * Usage: test_ring [path of the rsa program] (./rsa by default)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_error.h"
+#include "rsa_keys.h"
+#include "rsa_ring.h"
+
+// more blocks than slots: the ring wraps around
+#define NB_BLOCKS 	100
+#define NB_SLOTS 	16
+// slots handed over at once
+#define PUBLISH 	4
+
+static const char *key_files[] = { ".rsa/rsa.pub", ".rsa/rsa.priv", ".rsa/rsa.pub.bin", ".rsa/rsa.priv.bin" };
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+/**
+ * A block and what the server made of it
+ */
+struct block {
+	uint32_t op, len;
+	unsigned char in[RSA_MAX_BITS / 8];
+	uint32_t status, out_len;
+	unsigned char out[RSA_MAX_BITS / 8];
+};
+
+static void take(struct ring_slot *slot, struct block *block) {
+	block->status  = slot->status;
+	block->out_len = slot->len;
+	memcpy(block->out, slot->data, slot->len);
+}
+
+/**
+ * Run count blocks through the ring, from the sequence number *seq
+ *
+ * return -1 if the server left
+ */
+static int run(struct rsa_ring *ring, uint32_t *seq, struct block *blocks, int count) {
+	struct ring_slot *slot;
+	uint32_t first = *seq;
+	int i;
+
+	for (i=0; i<count; i++, (*seq)++) {
+		slot = ring_reserve(ring, *seq);
+		if (NULL == slot) {
+			return -1;
+		}
+
+		// completed a round ago: its result is still there
+		if (*seq - first >= ring->nb_slots) {
+			take(slot, &blocks[i - ring->nb_slots]);
+		}
+
+		// a length past the slot only tells the server a lie
+		slot->op  = blocks[i].op;
+		slot->len = blocks[i].len;
+		memcpy(slot->data, blocks[i].in, blocks[i].len <= sizeof(blocks[i].in) ? blocks[i].len : 0);
+		if (0 == (i + 1) % PUBLISH || i == count - 1) {
+			ring_publish(ring, *seq + 1);
+		}
+	}
+
+	if (-1 == ring_wait(ring, *seq - 1)) {
+		return -1;
+	}
+	for (i=(count > (int) ring->nb_slots ? count - ring->nb_slots : 0); i<count; i++) {
+		take(ring_slot(ring, first + i), &blocks[i]);
+	}
+
+	return 0;
+}
+
+/**
+ * Generate a key pair into a fresh directory and start the server there
+ *
+ * return the pid of the server, -1 if an error occured
+ */
+static pid_t start_server(const char *program, const char *name) {
+	struct rsa_priv K;
+	char slots[16];
+	pid_t pid;
+	mpz_t e;
+	int status;
+
+	mpz_init(e);
+	rsa_priv_init(&K);
+	status = generate_keypair(e, &K, 1024, 1);
+	if (0 == status) {
+		status = save_keypair(e, &K);
+	}
+	mpz_clear(e);
+	rsa_priv_clear(&K);
+	if (-1 == status) {
+		printf("FAIL setup: %s\n", rsa_errmsg());
+		return -1;
+	}
+
+	snprintf(slots, sizeof(slots), "%d", NB_SLOTS);
+	pid = fork();
+	if (0 == pid) {
+		freopen("/dev/null", "w", stdout);
+		execl(program, program, "--serve-ring", name, "--slots", slots, "--threads", "2", (char *) NULL);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+int main(int argc, char **argv) {
+	// vars
+	char program[PATH_MAX], dir[] = "/tmp/test_ring.XXXXXX", name[64];
+	struct block *blocks, *expected;
+	struct rsa_ring *ring;
+	uint32_t seq, k;
+	pid_t pid;
+	int i, j;
+
+	if (NULL == realpath(argc > 1 ? argv[1] : "./rsa", program)) {
+		printf("FAIL setup: no program %s\n", argc > 1 ? argv[1] : "./rsa");
+		return 1;
+	}
+	if (NULL == mkdtemp(dir) || chdir(dir) != 0 || mkdir(".rsa", 0700) != 0) {
+		printf("FAIL setup: temporary directory\n");
+		return 1;
+	}
+
+	snprintf(name, sizeof(name), "/qrsa-test-%d", (int) getpid());
+	pid = start_server(program, name);
+	if (pid < 0) {
+		return 1;
+	}
+
+	// the server creates the ring once the keys are loaded
+	ring = NULL;
+	for (i=0; i<200 && NULL == ring; i++) {
+		usleep(50000);
+		ring = ring_attach(name);
+	}
+	if (NULL == ring) {
+		printf("FAIL attach: %s\n", rsa_errmsg());
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+		return 1;
+	}
+	CHECK(NB_SLOTS == ring->nb_slots, "slots: %u", ring->nb_slots);
+	k = ring->header->k;
+
+	// encrypting blocks of every length up to k-11
+	blocks 	 = calloc(NB_BLOCKS, sizeof(*blocks));
+	expected = calloc(NB_BLOCKS, sizeof(*blocks));
+	for (i=0; i<NB_BLOCKS; i++) {
+		blocks[i].op  = RING_ENCRYPT;
+		blocks[i].len = i % (k - 10);
+		for (j=0; j<(int) blocks[i].len; j++) {
+			blocks[i].in[j] = rand();
+		}
+	}
+
+	seq = 0;
+	CHECK(0 == run(ring, &seq, blocks, NB_BLOCKS), "encrypt: the server left");
+	for (i=0; i<NB_BLOCKS; i++) {
+		CHECK(RING_OK == blocks[i].status && k == blocks[i].out_len, "encrypt %d: status %u, %u octets",
+			i, blocks[i].status, blocks[i].out_len);
+
+		// and back, the plaintext kept aside
+		expected[i] 	 = blocks[i];
+		blocks[i].op 	 = RING_DECRYPT;
+		blocks[i].len 	 = k;
+		memcpy(blocks[i].in, blocks[i].out, k);
+	}
+
+	CHECK(0 == run(ring, &seq, blocks, NB_BLOCKS), "decrypt: the server left");
+	for (i=0; i<NB_BLOCKS; i++) {
+		CHECK(RING_OK == blocks[i].status && expected[i].len == blocks[i].out_len
+			&& 0 == memcmp(expected[i].in, blocks[i].out, blocks[i].out_len),
+			"decrypt %d: status %u, %u octets", i, blocks[i].status, blocks[i].out_len);
+	}
+
+	// refused: unknown op, short ciphertext, too long plaintext, lengths
+	// past the slot
+	memset(blocks, 0, 6 * sizeof(*blocks));
+	blocks[0].op = 9;
+	blocks[1].op = RING_DECRYPT, blocks[1].len = k - 1;
+	blocks[2].op = RING_ENCRYPT, blocks[2].len = k - 10;
+	blocks[3].op = RING_DECRYPT, blocks[3].len = 0xffffffff;
+	blocks[4].op = RING_ENCRYPT, blocks[4].len = 0x80000000;
+	blocks[5].op = RING_ENCRYPT, blocks[5].len = 0;
+	CHECK(0 == run(ring, &seq, blocks, 6), "refused: the server left");
+	for (i=0; i<5; i++) {
+		CHECK(RING_EINVAL == blocks[i].status && 0 == blocks[i].out_len, "refused %d: status %u", i, blocks[i].status);
+	}
+	CHECK(RING_OK == blocks[5].status && k == blocks[5].out_len, "empty block: status %u", blocks[5].status);
+
+	free(blocks);
+	free(expected);
+	ring_detach(ring);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+
+	for (i=0; i<4; i++) {
+		unlink(key_files[i]);
+	}
+	rmdir(".rsa");
+	rmdir(dir);
+
+	printf("%s: %d failure(s)\n", __FILE__, failures);
+	return failures != 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * File: tests/test_split.c
+ * Created by Hamza ESSAYEGH (Querdos)
+ *
+ * The low-latency mode: on a machine of several CPUs, the helper runs on
+ * another CPU than its caller; then, forced with a faked count of CPUs,
+ * the claims of the helpers, and rsa_ctx_rsadp with helpers (alone,
+ * without a free CPU, from several threads at once) against rsadp_crt,
+ * for 2 to 4 primes.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <gmp.h>
+
+#include "rsa.h"
+#include "rsa_error.h"
+#include "rsa_pool.h"
+#include "rsa_split.h"
+
+#define NB_CPUS 		4
+#define NB_CIPHERS 		64
+#define NB_THREADS 		3
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { printf("FAIL " __VA_ARGS__); printf("\n"); failures++; } } while (0)
+
+struct key {
+	struct rsa_priv K;
+	mpz_t e;
+	mpz_t ciphers[NB_CIPHERS];
+	mpz_t expected[NB_CIPHERS]; 	// by rsadp_crt
+	int errors;
+};
+
+static void nothing(void *arg) {
+	(void) arg;
+}
+
+static void where(void *arg) {
+	*(int *) arg = sched_getcpu();
+}
+
+/**
+ * Run 'where' on the helper
+ *
+ * return the CPU of the helper, -1 if no CPU could be claimed
+ */
+static int helper_cpu(struct rsa_split *split) {
+	int cpu;
+
+	if (!split_claim(split)) {
+		return -1;
+	}
+	split_start(split, where, &cpu);
+	split_wait(split);
+	return cpu;
+}
+
+/**
+ * The helper and its caller on two CPUs, with the real count of CPUs,
+ * even once the caller has moved onto the CPU of the helper
+ */
+static void pinning(void) {
+	struct rsa_split *split;
+	cpu_set_t allowed, one;
+	int caller, helper;
+
+	if (!split_available() || 0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		printf("%s: one CPU, pinning not checked\n", __FILE__);
+		return;
+	}
+
+	split = split_create();
+	if (NULL == split) {
+		printf("FAIL split_create: %s\n", rsa_errmsg());
+		failures++;
+		return;
+	}
+
+	// the caller held on its CPU meanwhile
+	caller = sched_getcpu();
+	CPU_ZERO(&one);
+	CPU_SET(caller, &one);
+	sched_setaffinity(0, sizeof(one), &one);
+	helper = helper_cpu(split);
+	CHECK(helper >= 0 && helper != caller, "helper on CPU %d, its caller on %d", helper, caller);
+
+	// the caller moved onto the CPU of the helper
+	if (helper >= 0) {
+		CPU_ZERO(&one);
+		CPU_SET(helper, &one);
+		sched_setaffinity(0, sizeof(one), &one);
+		caller = helper;
+		helper = helper_cpu(split);
+		CHECK(helper >= 0 && helper != caller, "helper left on CPU %d with its caller", caller);
+	}
+
+	sched_setaffinity(0, sizeof(allowed), &allowed);
+	split_destroy(split);
+}
+
+/**
+ * Decrypt every ciphertext with a context in low-latency mode
+ *
+ * return the number of wrong results
+ */
+static int decrypt_all(struct key *key) {
+	struct rsa_ctx ctx;
+	mpz_t got;
+	int bad = 0, i;
+
+	if (-1 == rsa_ctx_init_priv(&ctx, &key->K)) {
+		return NB_CIPHERS;
+	}
+	if (-1 == rsa_ctx_split(&ctx, 1) || NULL == ctx.split) {
+		rsa_ctx_clear(&ctx);
+		return NB_CIPHERS;
+	}
+
+	mpz_init(got);
+	for (i=0; i<NB_CIPHERS; i++) {
+		bad += -1 == rsa_ctx_rsadp(&ctx, got, key->ciphers[i]) || mpz_cmp(got, key->expected[i]) != 0;
+	}
+	mpz_clear(got);
+
+	rsa_ctx_clear(&ctx);
+	return bad;
+}
+
+static void decrypt_job(void *arg, int i, int worker) {
+	struct key *key = arg;
+
+	(void) i;
+	(void) worker;
+	__atomic_add_fetch(&key->errors, decrypt_all(key), __ATOMIC_RELAXED);
+}
+
+/**
+ * Create the helpers and claim a CPU for each one, the caller holding
+ * the last CPU
+ *
+ * return the number of claims that succeeded
+ */
+static int claim_all(struct rsa_split **helpers) {
+	int i, claimed = 0;
+
+	for (i=0; i<NB_CPUS-1; i++) {
+		helpers[i] = split_create();
+		if (NULL != helpers[i] && split_claim(helpers[i])) {
+			split_start(helpers[i], nothing, NULL);
+			claimed++;
+		}
+	}
+
+	return claimed;
+}
+
+static void release_all(struct rsa_split **helpers) {
+	int i;
+
+	for (i=0; i<NB_CPUS-1; i++) {
+		if (NULL != helpers[i]) {
+			split_wait(helpers[i]);
+			split_destroy(helpers[i]);
+		}
+	}
+}
+
+/**
+ * Claims: the caller and each claimed helper hold a CPU
+ */
+static void claims(void) {
+	struct rsa_split *helpers[NB_CPUS-1];
+
+	CHECK(NB_CPUS-1 == claim_all(helpers), "claims of %d CPUs", NB_CPUS);
+	CHECK(0 == split_claim(helpers[0]), "claim past %d CPUs", NB_CPUS);
+
+	split_wait(helpers[0]);
+	CHECK(1 == split_claim(helpers[0]), "claim after a release");
+	split_start(helpers[0], nothing, NULL);
+	CHECK(0 == split_claim(helpers[0]), "claim past %d CPUs, after a release", NB_CPUS);
+
+	release_all(helpers);
+	helpers[0] = split_create();
+	CHECK(1 == split_claim(helpers[0]), "claim after every release");
+	split_start(helpers[0], nothing, NULL);
+	split_wait(helpers[0]);
+	split_destroy(helpers[0]);
+}
+
+static void check_key(int nb_primes, struct rsa_pool *pool) {
+	struct rsa_split *helpers[NB_CPUS-1];
+	struct key key;
+	mpz_t mi[RSA_MAX_PRIMES];
+	int i;
+
+	mpz_init(key.e);
+	rsa_priv_init(&key.K);
+	if (-1 == generate_keypair_multi(key.e, &key.K, 1024, nb_primes, 1)) {
+		printf("FAIL keys of %d primes: %s\n", nb_primes, rsa_errmsg());
+		failures++;
+		return;
+	}
+
+	// random, and 0, 1, n - 1
+	for (i=0; i<RSA_MAX_PRIMES; i++) {
+		mpz_init(mi[i]);
+	}
+	for (i=0; i<NB_CIPHERS; i++) {
+		mpz_inits(key.ciphers[i], key.expected[i], NULL);
+		if (i < 2) {
+			mpz_set_ui(key.ciphers[i], i);
+		} else if (2 == i) {
+			mpz_sub_ui(key.ciphers[i], key.K.n, 1);
+		} else {
+			mpz_set_ui(key.ciphers[i], rand());
+			mpz_powm_ui(key.ciphers[i], key.ciphers[i], 1000 + i, key.K.n);
+		}
+		rsadp_crt(key.expected[i], &key.K, key.ciphers[i], mi, NULL);
+	}
+	for (i=0; i<RSA_MAX_PRIMES; i++) {
+		mpz_clear(mi[i]);
+	}
+
+	CHECK(0 == decrypt_all(&key), "%d primes: split", nb_primes);
+
+	// every CPU claimed: on the caller alone
+	CHECK(NB_CPUS-1 == claim_all(helpers), "%d primes: claiming every CPU", nb_primes);
+	CHECK(0 == decrypt_all(&key), "%d primes: no free CPU", nb_primes);
+	release_all(helpers);
+
+	// several contexts at once, racing for the CPUs
+	key.errors = 0;
+	pool_run(pool, NB_THREADS, decrypt_job, &key);
+	CHECK(0 == key.errors, "%d primes: %d wrong results from %d threads", nb_primes, key.errors, NB_THREADS);
+
+	for (i=0; i<NB_CIPHERS; i++) {
+		mpz_clears(key.ciphers[i], key.expected[i], NULL);
+	}
+	rsa_priv_clear(&key.K);
+	mpz_clear(key.e);
+}
+
+int main() {
+	// vars
+	struct rsa_pool *pool;
+	struct rsa_priv K;
+	struct rsa_ctx ctx;
+	mpz_t e;
+	int u;
+
+	pinning();
+
+	split_set_cpus(NB_CPUS);
+	CHECK(split_available(), "split unavailable with %d CPUs", NB_CPUS);
+	claims();
+
+	pool = pool_create(NB_THREADS);
+	if (NULL == pool) {
+		printf("FAIL pool: %s\n", rsa_errmsg());
+		return 1;
+	}
+	for (u=2; u<=RSA_MAX_PRIMES; u++) {
+		check_key(u, pool);
+	}
+	pool_destroy(pool);
+
+	// one CPU: the mode stays off
+	split_set_cpus(1);
+	mpz_init(e);
+	rsa_priv_init(&K);
+	if (0 == generate_keypair(e, &K, 1024, 1) && 0 == rsa_ctx_init_priv(&ctx, &K)) {
+		CHECK(0 == rsa_ctx_split(&ctx, 1) && NULL == ctx.split, "split on one CPU");
+		rsa_ctx_clear(&ctx);
+	}
+	rsa_priv_clear(&K);
+	mpz_clear(e);
+
+	printf("%s: %d failure(s)\n", __FILE__, failures);
+	return failures != 0;
+}